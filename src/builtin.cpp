@@ -0,0 +1,248 @@
+#include <builtin.hpp>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <span>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace builtin {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// anything the shell would interpret; '>' is handled for echo separately
+constexpr std::string_view special_chars = "\"'\\$`*?[]{}~;&|<()#!\n";
+
+bool write_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    ssize_t w = write(fd, data.data(), data.size());
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w < 0)
+      return false;
+    data.remove_prefix(static_cast<size_t>(w));
+  }
+  return true;
+}
+
+int fail(std::string_view tool, const std::string &path, std::string_view why) {
+  std::cerr << tool << ": " << path << ": " << why << '\n';
+  return 1;
+}
+
+int mkdir_p(const Command &cmd) {
+  for (const auto &dir : cmd.args) {
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (ec || !fs::is_directory(dir))
+      return fail("mkdir", dir, ec ? ec.message() : "File exists");
+  }
+  return 0;
+}
+
+int touch(const Command &cmd) {
+  for (const auto &file : cmd.args) {
+    int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_NOCTTY | O_NONBLOCK,
+                  0666);
+    if (fd >= 0)
+      close(fd);
+    if (utimensat(AT_FDCWD, file.c_str(), nullptr, 0) != 0)
+      return fail("touch", file, std::strerror(errno));
+  }
+  return 0;
+}
+
+int cp(const Command &cmd) {
+  const fs::path src = cmd.args[0];
+  fs::path dst = cmd.args[1];
+
+  std::error_code ec;
+  if (fs::is_directory(src, ec))
+    return fail("cp", src.string(), "-r not specified; omitting directory");
+  if (fs::is_directory(dst, ec))
+    dst /= src.filename();
+
+  fs::copy_file(src, dst, fs::copy_options::overwrite_existing, ec);
+  if (ec)
+    return fail("cp", src.string(), ec.message());
+  return 0;
+}
+
+int rm_f(const Command &cmd) {
+  for (const auto &path : cmd.args) {
+    std::error_code ec;
+    const auto st = fs::symlink_status(path, ec);
+    if (!fs::exists(st))
+      continue;
+    if (fs::is_directory(st))
+      return fail("rm", path, "Is a directory");
+    if (!fs::remove(path, ec) && ec)
+      return fail("rm", path, ec.message());
+  }
+  return 0;
+}
+
+int ln_s(const Command &cmd, bool force) {
+  const fs::path target = cmd.args[0];
+  fs::path link = cmd.args[1];
+
+  std::error_code ec;
+  const auto st = fs::symlink_status(link, ec);
+  if (fs::is_directory(st)) {
+    link /= target.filename();
+  } else if (force && fs::exists(st)) {
+    fs::remove(link, ec);
+  }
+
+  fs::create_symlink(target, link, ec);
+  if (ec)
+    return fail("ln", link.string(), ec.message());
+  return 0;
+}
+
+int echo(const Command &cmd) {
+  std::string out;
+  for (size_t i = 0; i < cmd.args.size(); ++i) {
+    if (i != 0)
+      out.push_back(' ');
+    out += cmd.args[i];
+  }
+  out.push_back('\n');
+
+  if (cmd.redirect.empty()) {
+    return write_all(STDOUT_FILENO, out) ? 0 : 1;
+  }
+
+  const int flags = O_WRONLY | O_CREAT | (cmd.append ? O_APPEND : O_TRUNC);
+  int fd = open(cmd.redirect.c_str(), flags, 0666);
+  if (fd < 0)
+    return fail("echo", cmd.redirect, std::strerror(errno));
+  const bool ok = write_all(fd, out);
+  close(fd);
+  return ok ? 0 : fail("echo", cmd.redirect, std::strerror(errno));
+}
+
+} // namespace
+
+std::optional<Command> parse(std::string_view line) {
+  if (line.find_first_of(special_chars) != std::string_view::npos)
+    return std::nullopt;
+
+  std::vector<std::string_view> words;
+  while (true) {
+    const auto start = line.find_first_not_of(" \t");
+    if (start == std::string_view::npos)
+      break;
+    line.remove_prefix(start);
+    const auto end = line.find_first_of(" \t");
+    words.push_back(line.substr(0, end));
+    if (end == std::string_view::npos)
+      break;
+    line.remove_prefix(end);
+  }
+  if (words.empty())
+    return std::nullopt;
+
+  const auto tool = words[0];
+  std::span<const std::string_view> rest(words.begin() + 1, words.end());
+
+  Command cmd{};
+  auto take_args = [&](size_t from) {
+    for (size_t i = from; i < rest.size(); ++i)
+      cmd.args.emplace_back(rest[i]);
+  };
+
+  if (tool == "echo") {
+    // "> file" / ">> file" / ">file" / ">>file", only as the last words
+    size_t n = rest.size();
+    for (size_t i = 0; i < rest.size(); ++i) {
+      auto w = rest[i];
+      if (!w.starts_with('>'))
+        continue;
+      cmd.append = w.starts_with(">>");
+      w.remove_prefix(cmd.append ? 2 : 1);
+      if (w.empty()) {
+        if (i + 2 != rest.size())
+          return std::nullopt;
+        w = rest[i + 1];
+      } else if (i + 1 != rest.size()) {
+        return std::nullopt;
+      }
+      if (w.empty() || w.find('>') != std::string_view::npos)
+        return std::nullopt;
+      cmd.redirect = std::string(w);
+      n = i;
+      break;
+    }
+    for (size_t i = 0; i < n; ++i) {
+      // no options (-n, -e) and no stray '>'
+      if (rest[i].starts_with('-') || rest[i].find('>') != std::string_view::npos)
+        return std::nullopt;
+      cmd.args.emplace_back(rest[i]);
+    }
+    cmd.op = Op::Echo;
+    return cmd;
+  }
+
+  for (auto w : rest) {
+    if (w.find('>') != std::string_view::npos)
+      return std::nullopt;
+  }
+
+  auto no_options_from = [&](size_t from) {
+    for (size_t i = from; i < rest.size(); ++i) {
+      if (rest[i].starts_with('-'))
+        return false;
+    }
+    return true;
+  };
+
+  if (tool == "mkdir" && rest.size() >= 2 && rest[0] == "-p" &&
+      no_options_from(1)) {
+    cmd.op = Op::MkdirP;
+    take_args(1);
+  } else if (tool == "touch" && !rest.empty() && no_options_from(0)) {
+    cmd.op = Op::Touch;
+    take_args(0);
+  } else if (tool == "cp" && rest.size() == 2 && no_options_from(0)) {
+    cmd.op = Op::Cp;
+    take_args(0);
+  } else if (tool == "rm" && rest.size() >= 2 && rest[0] == "-f" &&
+             no_options_from(1)) {
+    cmd.op = Op::RmF;
+    take_args(1);
+  } else if (tool == "ln" && rest.size() == 3 &&
+             (rest[0] == "-s" || rest[0] == "-sf") && no_options_from(1)) {
+    cmd.op = rest[0] == "-s" ? Op::LnS : Op::LnSf;
+    take_args(1);
+  } else {
+    return std::nullopt;
+  }
+  return cmd;
+}
+
+int run(const Command &cmd) {
+  switch (cmd.op) {
+  case Op::MkdirP:
+    return mkdir_p(cmd);
+  case Op::Touch:
+    return touch(cmd);
+  case Op::Cp:
+    return cp(cmd);
+  case Op::RmF:
+    return rm_f(cmd);
+  case Op::LnS:
+    return ln_s(cmd, false);
+  case Op::LnSf:
+    return ln_s(cmd, true);
+  case Op::Echo:
+    return echo(cmd);
+  }
+  return 1;
+}
+
+} // namespace builtin
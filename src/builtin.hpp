@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// In-process implementations of trivial recipe lines, so they don't need a
+// shell and a fork. Only plain forms are recognized: no quoting, globbing,
+// variables or command chaining, those go through /bin/sh as usual.
+//
+//   mkdir -p <dir>...          touch <file>...
+//   cp <src> <dst>             rm -f <path>...
+//   ln -s[f] <target> <link>   echo <words>... [> file | >> file]
+namespace builtin {
+
+enum class Op : uint8_t { MkdirP, Touch, Cp, RmF, LnS, LnSf, Echo };
+
+struct Command {
+  Op op;
+  std::vector<std::string> args;
+  std::string redirect; // echo only, empty => stdout
+  bool append = false;
+};
+
+std::optional<Command> parse(std::string_view line);
+
+inline bool recognizes(std::string_view line) {
+  return parse(line).has_value();
+}
+
+// shell-like status: 0 on success, diagnostics on stderr
+int run(const Command &cmd);
+
+} // namespace builtin
@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <charconv>
+#include <cpu_topology.hpp>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <map>
+#include <sched.h>
+#include <string>
+#include <tuple>
+#include <utility>
+
+namespace exec {
+
+namespace {
+
+std::optional<uint32_t> read_sysfs_uint(const std::string &path) {
+  std::ifstream in(path);
+  uint32_t val;
+  if (in >> val)
+    return val;
+  return std::nullopt;
+}
+
+// "0-3,8,10-11"
+std::vector<int> parse_cpulist(std::string_view list) {
+  std::vector<int> cpus;
+  while (!list.empty()) {
+    const auto comma = list.find(',');
+    const auto range = list.substr(0, comma);
+    list = comma == std::string_view::npos ? std::string_view{}
+                                           : list.substr(comma + 1);
+
+    int lo = 0, hi = 0;
+    auto [p, ec] = std::from_chars(range.data(), range.data() + range.size(), lo);
+    if (ec != std::errc{})
+      continue;
+    hi = lo;
+    if (p != range.data() + range.size() && *p == '-')
+      std::from_chars(p + 1, range.data() + range.size(), hi);
+    for (int c = lo; c <= hi; ++c)
+      cpus.push_back(c);
+  }
+  return cpus;
+}
+
+// cpu => numa node
+std::map<int, uint32_t> read_numa_nodes() {
+  namespace fs = std::filesystem;
+  std::map<int, uint32_t> node_of;
+
+  std::error_code ec;
+  for (const auto &entry :
+       fs::directory_iterator("/sys/devices/system/node", ec)) {
+    const std::string name = entry.path().filename().string();
+    if (!name.starts_with("node"))
+      continue;
+    uint32_t node;
+    auto [p, err] =
+        std::from_chars(name.data() + 4, name.data() + name.size(), node);
+    if (err != std::errc{} || p != name.data() + name.size())
+      continue;
+
+    std::ifstream in(entry.path() / "cpulist");
+    std::string list;
+    std::getline(in, list);
+    for (int cpu : parse_cpulist(list))
+      node_of[cpu] = node;
+  }
+  return node_of;
+}
+
+} // namespace
+
+std::optional<Placement> parse_placement(std::string_view s) {
+  if (s == "none")
+    return Placement::None;
+  if (s == "spread")
+    return Placement::CoreSpread;
+  if (s == "pack")
+    return Placement::CorePack;
+  if (s == "numa-spread")
+    return Placement::NumaSpread;
+  if (s == "numa-pack")
+    return Placement::NumaPack;
+  return std::nullopt;
+}
+
+std::vector<CpuCore> read_cpu_topology() {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    return {};
+
+  const auto node_of = read_numa_nodes();
+
+  // (node, package, core id) => core
+  std::map<std::tuple<uint32_t, uint32_t, uint32_t>, CpuCore> cores;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (!CPU_ISSET(static_cast<size_t>(cpu), &allowed))
+      continue;
+
+    const auto base = std::format("/sys/devices/system/cpu/cpu{}/topology/", cpu);
+    const auto core = read_sysfs_uint(base + "core_id");
+    const auto package = read_sysfs_uint(base + "physical_package_id");
+    auto it = node_of.find(cpu);
+    const uint32_t node = it == node_of.end() ? 0 : it->second;
+
+    // unknown topology: treat every CPU as its own core
+    const auto key = core && package
+                         ? std::tuple{node, *package, *core}
+                         : std::tuple{node, 0u, static_cast<uint32_t>(cpu)};
+    auto &entry = cores[key];
+    entry.numa_node = node;
+    entry.cpus.push_back(cpu);
+  }
+
+  std::vector<CpuCore> out;
+  out.reserve(cores.size());
+  for (auto &[key, core] : cores)
+    out.push_back(std::move(core));
+  return out;
+}
+
+std::vector<std::vector<int>> plan_placement(Placement placement,
+                                             size_t workers) {
+  std::vector<std::vector<int>> plan(workers);
+  if (placement == Placement::None || workers == 0)
+    return plan;
+
+  const auto cores = read_cpu_topology();
+  if (cores.empty())
+    return plan;
+
+  // cores grouped per NUMA node, in node order
+  std::vector<std::vector<const CpuCore *>> nodes;
+  for (const auto &core : cores) {
+    if (nodes.empty() || nodes.back().front()->numa_node != core.numa_node)
+      nodes.emplace_back();
+    nodes.back().push_back(&core);
+  }
+
+  switch (placement) {
+  case Placement::CorePack:
+    for (size_t w = 0; w < workers; ++w)
+      plan[w] = cores[w % cores.size()].cpus;
+    break;
+
+  case Placement::CoreSpread: {
+    // node0 core0, node1 core0, ..., node0 core1, ...
+    std::vector<const CpuCore *> order;
+    order.reserve(cores.size());
+    for (size_t i = 0; order.size() < cores.size(); ++i) {
+      for (const auto &node : nodes) {
+        if (i < node.size())
+          order.push_back(node[i]);
+      }
+    }
+    for (size_t w = 0; w < workers; ++w)
+      plan[w] = order[w % order.size()]->cpus;
+    break;
+  }
+
+  case Placement::NumaSpread:
+  case Placement::NumaPack: {
+    std::vector<std::vector<int>> node_cpus;
+    for (const auto &node : nodes) {
+      auto &cpus = node_cpus.emplace_back();
+      for (const auto *core : node)
+        cpus.insert(cpus.end(), core->cpus.begin(), core->cpus.end());
+    }
+
+    if (placement == Placement::NumaSpread) {
+      for (size_t w = 0; w < workers; ++w)
+        plan[w] = node_cpus[w % node_cpus.size()];
+    } else {
+      // fill a node with as many workers as it has cores, then move on
+      size_t node = 0, used = 0;
+      for (size_t w = 0; w < workers; ++w) {
+        if (used == nodes[node].size()) {
+          node = (node + 1) % nodes.size();
+          used = 0;
+        }
+        plan[w] = node_cpus[node];
+        used++;
+      }
+    }
+    break;
+  }
+
+  case Placement::None:
+    break;
+  }
+
+  return plan;
+}
+
+} // namespace exec
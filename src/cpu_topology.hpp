@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace exec {
+
+// How workers are pinned: each worker gets one physical core (with its SMT
+// siblings) or one whole NUMA node. Spread round-robins across NUMA nodes,
+// pack fills one node before moving to the next.
+enum class Placement : uint8_t {
+  None,
+  CoreSpread,
+  CorePack,
+  NumaSpread,
+  NumaPack,
+};
+
+std::optional<Placement> parse_placement(std::string_view s);
+
+struct CpuCore {
+  uint32_t numa_node;
+  std::vector<int> cpus; // SMT siblings
+};
+
+// Cores we are allowed to run on (current affinity mask), ordered by NUMA
+// node then core. Falls back to one core per allowed CPU on node 0 when
+// sysfs is unavailable.
+std::vector<CpuCore> read_cpu_topology();
+
+// CPU set for each of `workers` workers; empty when unpinned.
+std::vector<std::vector<int>> plan_placement(Placement placement,
+                                             size_t workers);
+
+} // namespace exec
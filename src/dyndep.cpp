@@ -0,0 +1,88 @@
+#include <dyndep.hpp>
+#include <file_reader.hpp>
+#include <format>
+#include <utils.hpp>
+
+namespace exec {
+
+namespace {
+
+template <typename T>
+std::span<const T>
+lookup(const std::unordered_map<DyndepOverlay::NodeId, std::vector<T>> &map,
+       DyndepOverlay::NodeId id) {
+  auto it = map.find(id);
+  if (it == map.end()) {
+    return {};
+  }
+  return {it->second.data(), it->second.size()};
+}
+
+} // namespace
+
+std::vector<parse::Rule> DyndepOverlay::read(const std::string &path) {
+  parse::StreamParser parser;
+  FileReader(path).for_each_line(
+      [&parser](std::string &line) { parser.feed(line); });
+  parser.finish();
+  if (parser.error()) {
+    fatal(std::format("dyndep: {}: {}", path, *parser.error()).c_str());
+  }
+  auto parsed = parser.take();
+
+  bool plain = parsed.phony.empty() && parsed.pattern_rules.empty() &&
+               parsed.pools.empty() && parsed.pool_members.empty() &&
+               parsed.dyndeps.empty();
+  for (const auto &rule : parsed.rules) {
+    plain = plain && rule.commands.empty() && rule.order_only.empty() &&
+            rule.grouped.empty();
+  }
+  if (!plain) {
+    fatal(std::format("dyndep: {}: only `target: prerequisites` lines allowed",
+                      path)
+              .c_str());
+  }
+  return std::move(parsed.rules);
+}
+
+void DyndepOverlay::add_edge(NodeId from, NodeId to) {
+  m_children[from].push_back(to);
+  m_parents[to].push_back(from);
+}
+
+void DyndepOverlay::add_input(NodeId to, std::string path) {
+  m_inputs[to].push_back(std::move(path));
+}
+
+std::span<const DyndepOverlay::NodeId>
+DyndepOverlay::children(NodeId id) const {
+  return lookup(m_children, id);
+}
+
+std::span<const DyndepOverlay::NodeId>
+DyndepOverlay::parents(NodeId id) const {
+  return lookup(m_parents, id);
+}
+
+std::span<const std::string> DyndepOverlay::inputs(NodeId id) const {
+  return lookup(m_inputs, id);
+}
+
+std::vector<std::string> DyndepOverlay::all_inputs() const {
+  std::vector<std::string> out;
+  for (const auto &[id, paths] : m_inputs) {
+    out.insert(out.end(), paths.begin(), paths.end());
+  }
+  return out;
+}
+
+std::vector<DyndepOverlay::NodeId> DyndepOverlay::all_sources() const {
+  std::vector<NodeId> out;
+  out.reserve(m_children.size());
+  for (const auto &[id, children] : m_children) {
+    out.push_back(id);
+  }
+  return out;
+}
+
+} // namespace exec
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <parse.hpp>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace exec {
+
+// Edges discovered during a build, layered over the immutable Graph.
+//
+// `.DYNDEP: <targets...>` marks targets whose recipe (typically a scanner)
+// writes a dyndep file at that path. Once such a node is done, the
+// scheduler reads the file and adds its edges here before releasing the
+// node's dependents, so the targets it names pick them up in the same run.
+// The file uses the rule syntax without recipes:
+//
+//   foo.o: mod_a.mod gen/config.h
+//
+// A prerequisite that is a node of the build has to be done before the
+// target starts, and joins the build if the goal didn't need it yet; any
+// other path is an extra input, compared by mtime only.
+// Named targets must not have started yet: they should depend on the
+// dyndep file.
+class DyndepOverlay {
+public:
+  using NodeId = uint32_t;
+
+  // fatal on anything but `target: prerequisites` lines
+  static std::vector<parse::Rule> read(const std::string &path);
+
+  void add_edge(NodeId from, NodeId to);
+  void add_input(NodeId to, std::string path);
+
+  std::span<const NodeId> children(NodeId id) const;
+  std::span<const NodeId> parents(NodeId id) const;
+  std::span<const std::string> inputs(NodeId id) const;
+
+  // every extra input of the run (for the fingerprints)
+  std::vector<std::string> all_inputs() const;
+  // every node with an edge out of it (for the fingerprints)
+  std::vector<NodeId> all_sources() const;
+
+private:
+  std::unordered_map<NodeId, std::vector<NodeId>> m_children;
+  std::unordered_map<NodeId, std::vector<NodeId>> m_parents;
+  std::unordered_map<NodeId, std::vector<std::string>> m_inputs;
+};
+
+} // namespace exec
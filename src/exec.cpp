@@ -1,77 +1,568 @@
+#include <charconv>
 #include <exec.hpp>
 #include <filesystem>
+#include <algorithm>
+#include <builtin.hpp>
 #include <format>
+#include <parallel.hpp>
 #include <queue>
 #include <serde_utils.hpp>
+#include <stats.hpp>
 #include <unordered_map>
+#include <utility>
 #include <utils.hpp>
 
 namespace exec {
 
-Graph Graph::build(const parse::Result &parsed) {
-  std::unordered_map<std::string, NodeId> id_map;
-  id_map.reserve(parsed.rules.size());
-  std::vector<std::string> names;
-  names.reserve(parsed.rules.size());
+std::optional<std::string_view> match_pattern(std::string_view pattern,
+                                              std::string_view name) {
+  const auto pct = pattern.find('%');
+  const auto prefix = pattern.substr(0, pct);
+  const auto suffix = pattern.substr(pct + 1);
+  if (name.size() <= prefix.size() + suffix.size() ||
+      !name.starts_with(prefix) || !name.ends_with(suffix)) {
+    return std::nullopt;
+  }
+  return name.substr(prefix.size(),
+                     name.size() - prefix.size() - suffix.size());
+}
 
-  for (NodeId i = 0; i < parsed.rules.size(); ++i) {
-    auto [it, ok] = id_map.emplace(parsed.rules[i].name, i);
-    names.push_back(parsed.rules[i].name);
-    if (!ok) {
-      fatal("duplicate rule name");
+namespace {
+
+std::string substitute_stem(std::string_view pattern, std::string_view stem) {
+  const auto pct = pattern.find('%');
+  if (pct == std::string_view::npos) {
+    return std::string(pattern);
+  }
+  std::string out;
+  out.reserve(pattern.size() + stem.size());
+  out.append(pattern.substr(0, pct)).append(stem).append(pattern.substr(pct + 1));
+  return out;
+}
+
+// Template line with automatic variables replaced by a plain word, to tell
+// whether its expansions can be builtins. "$$" stays and disqualifies it.
+std::string with_placeholders(std::string_view cmd) {
+  std::string out;
+  out.reserve(cmd.size());
+  for (size_t i = 0; i < cmd.size(); ++i) {
+    if (cmd[i] == '$' && i + 1 < cmd.size() &&
+        std::string_view("@<^|*").find(cmd[i + 1]) != std::string_view::npos) {
+      out.push_back('x');
+      ++i;
+    } else {
+      out.push_back(cmd[i]);
+    }
+  }
+  return out;
+}
+
+// below this, Graph::build stays on the calling thread
+constexpr size_t min_rules_per_thread = 16384;
+
+} // namespace
+
+void MemoryPressure::resolve_path() {
+  namespace fs = std::filesystem;
+
+  // prefer our own cgroup v2 group ("0::/path"), fall back to system-wide
+  std::ifstream cg("/proc/self/cgroup");
+  std::string line;
+  while (std::getline(cg, line)) {
+    if (line.starts_with("0::")) {
+      std::string path = "/sys/fs/cgroup" + line.substr(3) + "/memory.pressure";
+      if (fs::exists(path)) {
+        m_path = std::move(path);
+        return;
+      }
+    }
+  }
+  if (fs::exists("/proc/pressure/memory")) {
+    m_path = "/proc/pressure/memory";
+  }
+}
+
+double MemoryPressure::avg10() {
+  if (!m_resolved) {
+    resolve_path();
+    m_resolved = true;
+  }
+
+  const auto now = std::chrono::steady_clock::now();
+  if (m_path.empty() || now - m_last_read < refresh_interval) {
+    return m_avg10;
+  }
+  m_last_read = now;
+
+  // "some avg10=1.23 avg60=... total=..."
+  std::ifstream in(m_path);
+  std::string line;
+  while (std::getline(in, line)) {
+    if (!line.starts_with("some "))
+      continue;
+    auto pos = line.find("avg10=");
+    if (pos == std::string::npos)
+      break;
+    const char *first = line.data() + pos + 6;
+    std::from_chars(first, line.data() + line.size(), m_avg10);
+    break;
+  }
+  return m_avg10;
+}
+
+// Explicit rules are handled in parallel where the result doesn't depend
+// on order: copying names and recipes, filling the name index, looking up
+// prerequisites and building the parent and child lists. Everything that
+// creates nodes or reports errors (pattern instances, missing
+// prerequisites) runs in rule order on one thread, so node ids, edge
+// order and the first error are the same as with a single thread.
+Graph Graph::build(const parse::Result &parsed, OptimizeStats *optimize) {
+  const auto &rules = parsed.rules;
+  NodeId n = static_cast<NodeId>(rules.size());
+  const size_t threads = worker_threads(n, min_rules_per_thread);
+
+  std::vector<std::string> names(n);
+  std::vector<Node> nodes(n);
+  parallel_chunks(n, threads, [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      names[i] = rules[i].name;
+      nodes[i] = rules[i].commands;
     }
+  });
+
+  NameIndex id_map;
+  if (id_map.assign(names, threads) != NameIndex::npos) {
+    fatal("duplicate rule name");
   }
 
-  const NodeId n = static_cast<NodeId>(parsed.rules.size());
+  std::unordered_map<NodeId, Node> grouped;
+  // every output of a grouped rule names the same node
+  for (NodeId i = 0; i < rules.size(); ++i) {
+    if (rules[i].grouped.empty()) {
+      continue;
+    }
+    for (const auto &out : rules[i].grouped) {
+      if (!id_map.emplace(out, i)) {
+        fatal(std::format("duplicate rule name: {}", out).c_str());
+      }
+    }
+    grouped.emplace(i, rules[i].grouped);
+  }
 
   std::vector<std::vector<NodeId>> adj(n), rev(n);
-  std::vector<Node> nodes;
-  nodes.reserve(n);
+  std::vector<uint32_t> template_of(n, Graph::no_template);
+
+  // Pattern rules are kept as templates. Instances only get a name and a
+  // template id; their recipe is expanded when dispatched.
+  std::vector<Node> templates;
+  std::vector<std::string> template_targets;
+  templates.reserve(parsed.pattern_rules.size());
+  template_targets.reserve(parsed.pattern_rules.size());
+  for (const auto &rule : parsed.pattern_rules) {
+    templates.push_back(rule.commands);
+    template_targets.push_back(rule.name);
+  }
+
+  // best template for `name`: shortest stem, then declaration order
+  auto find_template = [&](const std::string &name) -> uint32_t {
+    uint32_t best = Graph::no_template;
+    size_t best_stem = std::numeric_limits<size_t>::max();
+    for (uint32_t t = 0; t < template_targets.size(); ++t) {
+      auto stem = match_pattern(template_targets[t], name);
+      if (stem && stem->size() < best_stem) {
+        best = t;
+        best_stem = stem->size();
+      }
+    }
+    return best;
+  };
+
+  auto link = [&](NodeId parent, NodeId child) {
+    adj[parent].push_back(child);
+    rev[child].push_back(parent);
+  };
+
+  // order-only: a scheduling edge that isn't a parent for mtime checks
+  std::unordered_map<NodeId, std::vector<NodeId>> order_only;
+  auto link_order_only = [&](NodeId parent, NodeId child) {
+    adj[parent].push_back(child);
+    order_only[child].push_back(parent);
+  };
+
+  // prerequisites of pattern instances, resolved breadth-first
+  struct PendingDeps {
+    NodeId child;
+    uint32_t depth;
+    std::vector<std::string> deps;
+    std::vector<std::string> order_only;
+  };
+  std::vector<PendingDeps> pending;
+
+  auto template_deps = [&](uint32_t t, NodeId child, uint32_t depth) {
+    const std::string_view stem =
+        *match_pattern(template_targets[t], names[child]);
+    PendingDeps out{child, depth, {}, {}};
+    out.deps.reserve(parsed.pattern_rules[t].deps.size());
+    for (const auto &dep : parsed.pattern_rules[t].deps) {
+      out.deps.push_back(substitute_stem(dep, stem));
+    }
+    for (const auto &dep : parsed.pattern_rules[t].order_only) {
+      out.order_only.push_back(substitute_stem(dep, stem));
+    }
+    return out;
+  };
+
+  auto add_node = [&](const std::string &name, uint32_t t) -> NodeId {
+    const NodeId id = n++;
+    id_map.emplace(name, id);
+    names.push_back(name);
+    nodes.emplace_back();
+    adj.emplace_back();
+    rev.emplace_back();
+    template_of.push_back(t);
+    return id;
+  };
+
+  // explicit rule without a recipe: take it from a matching pattern,
+  // pattern prerequisites first so $< refers to them
+  if (!templates.empty()) {
+    for (NodeId i = 0; i < rules.size(); ++i) {
+      if (!rules[i].commands.empty()) {
+        continue;
+      }
+      if (const uint32_t t = find_template(rules[i].name);
+          t != Graph::no_template) {
+        template_of[i] = t;
+        pending.push_back(template_deps(t, i, 0));
+      }
+    }
+  }
+
+  // Explicit prerequisites of rule i, deps then order-only, are
+  // resolved[offsets[i] ..]. Names not found here (pattern instances,
+  // missing files) are taken in rule order afterwards.
+  std::vector<size_t> offsets(rules.size() + 1, 0);
+  for (size_t i = 0; i < rules.size(); ++i) {
+    offsets[i + 1] =
+        offsets[i] + rules[i].deps.size() + rules[i].order_only.size();
+  }
+  std::vector<NodeId> resolved(offsets.back());
+  parallel_chunks(rules.size(), threads, [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      size_t k = offsets[i];
+      for (const auto &dep : rules[i].deps) {
+        resolved[k++] = id_map.find(dep);
+      }
+      for (const auto &dep : rules[i].order_only) {
+        resolved[k++] = id_map.find(dep);
+      }
+    }
+  });
 
-  for (const auto &rule : parsed.rules) {
-    const NodeId child = id_map.at(rule.name);
-    nodes.push_back(rule.commands);
+  auto resolve_explicit = [&](const std::string &dep) -> NodeId {
+    if (const NodeId id = id_map.find(dep); id != NameIndex::npos) {
+      return id;
+    }
+    if (const uint32_t t = find_template(dep); t != Graph::no_template) {
+      const NodeId parent = add_node(dep, t);
+      pending.push_back(template_deps(t, parent, 1));
+      return parent;
+    }
+    fatal(std::format("dependency not found: {}", dep).c_str());
+  };
 
-    for (const auto &dep : rule.deps) {
-      auto it = id_map.find(dep);
-      if (it == id_map.end())
-        fatal("dependency not found");
+  for (size_t i = 0; i < rules.size(); ++i) {
+    for (size_t k = offsets[i]; k < offsets[i + 1]; ++k) {
+      if (resolved[k] != NameIndex::npos) {
+        continue;
+      }
+      const size_t j = k - offsets[i];
+      const auto &deps = rules[i].deps;
+      resolved[k] = resolve_explicit(j < deps.size()
+                                         ? deps[j]
+                                         : rules[i].order_only[j - deps.size()]);
+    }
+  }
 
-      const NodeId parent = it->second;
-      adj[parent].push_back(child);
-      rev[child].push_back(parent);
+  // parent lists of explicit rules
+  parallel_chunks(rules.size(), threads, [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      const auto from = resolved.begin() + static_cast<long>(offsets[i]);
+      rev[i].assign(from, from + static_cast<long>(rules[i].deps.size()));
+    }
+  });
+  for (NodeId i = 0; i < rules.size(); ++i) {
+    if (!rules[i].order_only.empty()) {
+      const auto from = resolved.begin() +
+                        static_cast<long>(offsets[i] + rules[i].deps.size());
+      order_only.emplace(
+          i, std::vector<NodeId>(
+                 from, resolved.begin() + static_cast<long>(offsets[i + 1])));
     }
   }
 
+  // Child lists by counting sort. Each rule range (one per thread) counts
+  // its edges per parent; prefix sums over the ranges give every range its
+  // own slots in each parent's list, so children stay in rule order and
+  // every edge is touched twice in total. Instance edges are appended
+  // afterwards.
+  if (!rules.empty()) {
+    // the same split as parallel_chunks
+    const size_t per = (rules.size() + threads - 1) / threads;
+    const size_t ranges = (rules.size() + per - 1) / per;
+    std::vector<std::vector<uint32_t>> slot(ranges, std::vector<uint32_t>(n));
+    parallel_chunks(rules.size(), threads, [&](size_t first, size_t last) {
+      auto &count = slot[first / per];
+      for (size_t k = offsets[first]; k < offsets[last]; ++k) {
+        count[resolved[k]]++;
+      }
+    });
+    parallel_chunks(n, threads, [&](size_t first, size_t last) {
+      for (size_t p = first; p < last; ++p) {
+        uint32_t total = 0;
+        for (auto &count : slot) {
+          total += std::exchange(count[p], total);
+        }
+        adj[p].resize(total);
+      }
+    });
+    parallel_chunks(rules.size(), threads, [&](size_t first, size_t last) {
+      auto &next = slot[first / per];
+      for (NodeId i = static_cast<NodeId>(first); i < last; ++i) {
+        for (size_t k = offsets[i]; k < offsets[i + 1]; ++k) {
+          adj[resolved[k]][next[resolved[k]]++] = i;
+        }
+      }
+    });
+  }
+
+  // Instance prerequisites with neither a rule nor a usable pattern are
+  // plain source files: leaf nodes without a recipe.
+  constexpr uint32_t max_chain = 16;
+  for (size_t k = 0; k < pending.size(); ++k) {
+    const NodeId child = pending[k].child;
+    const uint32_t depth = pending[k].depth;
+    const auto deps = std::move(pending[k].deps);
+    const auto order_only_deps = std::move(pending[k].order_only);
+
+    auto resolve = [&](const std::string &dep) -> NodeId {
+      if (const NodeId id = id_map.find(dep); id != NameIndex::npos) {
+        return id;
+      }
+      if (const uint32_t t = find_template(dep);
+          t != Graph::no_template && depth < max_chain) {
+        const NodeId parent = add_node(dep, t);
+        pending.push_back(template_deps(t, parent, depth + 1));
+        return parent;
+      }
+      return add_node(dep, Graph::no_template);
+    };
+
+    for (const auto &dep : deps) {
+      link(resolve(dep), child);
+    }
+    for (const auto &dep : order_only_deps) {
+      link_order_only(resolve(dep), child);
+    }
+  }
+
+  // explicit deps were linked after pattern deps were queued; put pattern
+  // deps of explicit rules first again
+  for (NodeId i = 0; i < parsed.rules.size(); ++i) {
+    if (template_of[i] == Graph::no_template || parsed.rules[i].deps.empty())
+      continue;
+    auto &parents = rev[i];
+    const auto n_explicit = static_cast<long>(parsed.rules[i].deps.size());
+    std::rotate(parents.begin(), parents.begin() + n_explicit, parents.end());
+  }
+
   std::unordered_set<NodeId> phoneyset;
 
   for (const auto &p : parsed.phony) {
-    auto fnd = id_map.find(p);
-    if (fnd == id_map.end()) {
+    const NodeId id = id_map.find(p);
+    if (id == NameIndex::npos) {
       fatal("phony command not found in build");
     }
-    phoneyset.insert(fnd->second);
+    phoneyset.insert(id);
+  }
+
+  std::unordered_map<std::string, PoolId> pool_ids;
+  std::vector<std::string> pool_names;
+  std::vector<uint32_t> pool_depths;
+  for (const auto &pool : parsed.pools) {
+    auto [it, ok] =
+        pool_ids.emplace(pool.name, static_cast<PoolId>(pool_names.size()));
+    if (!ok) {
+      fatal("duplicate pool name");
+    }
+    pool_names.push_back(pool.name);
+    pool_depths.push_back(pool.depth);
+  }
+
+  // recipes made only of builtin forms run in the worker without a shell
+  std::vector<uint8_t> template_builtin(templates.size());
+  for (size_t t = 0; t < templates.size(); ++t) {
+    template_builtin[t] = std::all_of(
+        templates[t].begin(), templates[t].end(), [](const std::string &cmd) {
+          return builtin::recognizes(with_placeholders(cmd));
+        });
+  }
+  std::vector<uint8_t> builtin_only(n);
+  parallel_chunks(n, threads, [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      builtin_only[i] =
+          template_of[i] != Graph::no_template
+              ? template_builtin[template_of[i]]
+              : std::all_of(nodes[i].begin(), nodes[i].end(),
+                            [](const std::string &cmd) {
+                              return builtin::recognizes(cmd);
+                            });
+    }
+  });
+
+  std::vector<PoolId> pool_of(n, Graph::no_pool);
+  for (const auto &[pool, target] : parsed.pool_members) {
+    auto pit = pool_ids.find(pool);
+    if (pit == pool_ids.end()) {
+      fatal(std::format("pool: {} not declared", pool).c_str());
+    }
+    const NodeId member = id_map.find(target);
+    if (member == NameIndex::npos) {
+      fatal(std::format("pool member: {} not found in build", target).c_str());
+    }
+    pool_of[member] = pit->second;
+  }
+
+  std::vector<NodeId> dyndeps;
+  for (const auto &d : parsed.dyndeps) {
+    const NodeId id = id_map.find(d);
+    if (id == NameIndex::npos) {
+      fatal(std::format("dyndep: {} not found in build", d).c_str());
+    }
+    dyndeps.push_back(id);
+  }
+  std::sort(dyndeps.begin(), dyndeps.end());
+  dyndeps.erase(std::unique(dyndeps.begin(), dyndeps.end()), dyndeps.end());
+
+  if (optimize) {
+    optimize->duplicate = dedupe_edges(adj);
+    dedupe_edges(rev);
+  }
+
+  // Only the optimize pass needs the index at this point; queries build it
+  // on demand. It covers the full relation, the pass below only thins out
+  // scheduling edges, so it has to be built before the pass.
+  ReachIndex reach;
+  if (optimize) {
+    reach = ReachIndex::build(adj);
+    std::vector<uint8_t> alias(n, 0);
+    for (NodeId p : phoneyset) {
+      alias[p] = template_of[p] != Graph::no_template
+                     ? templates[template_of[p]].empty()
+                     : nodes[p].empty();
+    }
+    optimize_schedule(adj, alias, reach, *optimize);
   }
 
   return Graph(std::move(nodes), std::move(adj), std::move(rev),
-               std::move(id_map), std::move(phoneyset), std::move(names));
+               std::move(id_map), std::move(phoneyset), std::move(names),
+               std::move(pool_of), std::move(pool_names),
+               std::move(pool_depths), std::move(template_of),
+               std::move(templates), std::move(template_targets),
+               std::move(builtin_only), std::move(dyndeps), std::move(grouped),
+               std::move(order_only), std::move(reach));
 }
 
-void Graph::serialize() const {
-  std::vector<std::byte> bytestream;
-  bytestream.reserve(4096);
+Node Graph::expand_recipe(NodeId id) const {
+  const uint32_t t = m_template_of[id];
+  const std::string &name = m_names[id];
+  const std::string_view stem = *match_pattern(m_template_targets[t], name);
+  const auto parents = get_parent_ids(id);
+  const auto order_only = get_order_only_ids(id);
+
+  Node out;
+  out.reserve(m_templates[t].size());
+  for (const auto &cmd : m_templates[t]) {
+    std::string line;
+    line.reserve(cmd.size() + name.size());
+
+    for (size_t i = 0; i < cmd.size(); ++i) {
+      if (cmd[i] != '$' || i + 1 == cmd.size()) {
+        line.push_back(cmd[i]);
+        continue;
+      }
+
+      switch (cmd[++i]) {
+      case '@':
+        line += name;
+        break;
+      case '<':
+        if (!parents.empty())
+          line += m_names[parents[0]];
+        break;
+      case '^':
+        // all prerequisites, duplicates removed
+        for (size_t k = 0; k < parents.size(); ++k) {
+          if (std::find(parents.begin(), parents.begin() + static_cast<long>(k),
+                        parents[k]) != parents.begin() + static_cast<long>(k))
+            continue;
+          if (k != 0)
+            line.push_back(' ');
+          line += m_names[parents[k]];
+        }
+        break;
+      case '|':
+        for (size_t k = 0; k < order_only.size(); ++k) {
+          if (k != 0)
+            line.push_back(' ');
+          line += m_names[order_only[k]];
+        }
+        break;
+      case '*':
+        line += stem;
+        break;
+      case '$':
+        line.push_back('$');
+        break;
+      default:
+        line.push_back('$');
+        line.push_back(cmd[i]);
+      }
+    }
+    out.push_back(std::move(line));
+  }
+  return out;
+}
 
-  // version
-  auto ver = serde::serialize_value<uint32_t>(GRAPH_SERDE_VERSION);
-  bytestream.insert(bytestream.end(), ver.begin(), ver.end());
+void Graph::serialize() const {
+  const std::vector<NodeId> phony(this->m_phony.begin(), this->m_phony.end());
+  std::vector<NodeId> grouped_ids;
+  std::vector<Node> grouped_outputs;
+  grouped_ids.reserve(m_grouped.size());
+  grouped_outputs.reserve(m_grouped.size());
+  for (const auto &[id, outputs] : m_grouped) {
+    grouped_ids.push_back(id);
+    grouped_outputs.push_back(outputs);
+  }
+  std::vector<NodeId> order_only_ids;
+  std::vector<std::vector<NodeId>> order_only_parents;
+  order_only_ids.reserve(m_order_only.size());
+  order_only_parents.reserve(m_order_only.size());
+  for (const auto &[id, parents] : m_order_only) {
+    order_only_ids.push_back(id);
+    order_only_parents.push_back(parents);
+  }
 
-  serde::serialize_vec(this->m_node_store, bytestream);
-  serde::serialize_vec(this->m_adjgraph, bytestream);
-  serde::serialize_vec(this->m_reverse_adj, bytestream);
-  serde::serialize_map(this->m_id_map, bytestream);
-  serde::serialize_vec(std::vector(this->m_phony.begin(), this->m_phony.end()),
-                       bytestream);
-  serde::serialize_vec(this->m_names, bytestream);
+  const auto bytestream = serde::serialize_all(
+      GRAPH_SERDE_VERSION, this->m_node_store, this->m_adjgraph,
+      this->m_reverse_adj, phony, this->m_names,
+      this->m_pool_of, this->m_pool_names, this->m_pool_depths,
+      this->m_template_of, this->m_templates, this->m_template_targets,
+      this->m_builtin, this->m_dyndeps, grouped_ids, grouped_outputs,
+      order_only_ids, order_only_parents, this->m_reach.post_numbers(),
+      this->m_reach.by_post(), this->m_reach.offsets(),
+      this->m_reach.intervals(), this->m_reach.edge_offsets(),
+      this->m_reach.edges());
 
   std::ofstream out(Graph::serialize_file, std::ios::binary | std::ios::trunc);
   if (!out) {
@@ -85,6 +576,13 @@ void Graph::serialize() const {
   }
 }
 
+bool Graph::cache_current() {
+  std::ifstream in(Graph::serialize_file, std::ios::binary);
+  uint32_t version = 0;
+  in.read(reinterpret_cast<char *>(&version), sizeof(version));
+  return in && serde::to_wire(version) == GRAPH_SERDE_VERSION;
+}
+
 Graph Graph::deserialize() {
   namespace fs = std::filesystem;
 
@@ -109,42 +607,178 @@ Graph Graph::deserialize() {
     fatal("failed to read graph cache");
   }
 
-  const std::byte *ptr = buffer.data();
+  serde::Reader reader(buffer);
 
   // ---- version check ----
-  uint32_t version = serde::deserialize_value<uint32_t>(ptr);
+  uint32_t version = reader.read<uint32_t>();
   if (version != GRAPH_SERDE_VERSION) {
     fatal("graph cache version mismatch");
   }
 
   // ---- payload ----
-  auto node_store = serde::deserialize_vec<std::vector<Node>>(ptr);
-  auto adjgraph = serde::deserialize_vec<std::vector<std::vector<NodeId>>>(ptr);
-  auto reverse_adj =
-      serde::deserialize_vec<std::vector<std::vector<NodeId>>>(ptr);
-  auto id_map =
-      serde::deserialize_map<std::unordered_map<std::string, NodeId>>(ptr);
-  auto phony = serde::deserialize_vec<std::vector<NodeId>>(ptr);
-  auto names = serde::deserialize_vec<std::vector<std::string>>(ptr);
+  auto node_store = reader.read<std::vector<Node>>();
+  auto adjgraph = reader.read<std::vector<std::vector<NodeId>>>();
+  auto reverse_adj = reader.read<std::vector<std::vector<NodeId>>>();
+  auto phony = reader.read<std::vector<NodeId>>();
+  auto names = reader.read<std::vector<std::string>>();
+  auto pool_of = reader.read<std::vector<PoolId>>();
+  auto pool_names = reader.read<std::vector<std::string>>();
+  auto pool_depths = reader.read<std::vector<uint32_t>>();
+  auto template_of = reader.read<std::vector<uint32_t>>();
+  auto templates = reader.read<std::vector<Node>>();
+  auto template_targets = reader.read<std::vector<std::string>>();
+  auto builtin = reader.read<std::vector<uint8_t>>();
+  auto dyndeps = reader.read<std::vector<NodeId>>();
+  auto grouped_ids = reader.read<std::vector<NodeId>>();
+  auto grouped_outputs = reader.read<std::vector<Node>>();
+  auto order_only_ids = reader.read<std::vector<NodeId>>();
+  auto order_only_parents = reader.read<std::vector<std::vector<NodeId>>>();
+  auto post = reader.read<std::vector<uint32_t>>();
+  auto by_post = reader.read<std::vector<NodeId>>();
+  auto reach_offsets = reader.read<std::vector<uint32_t>>();
+  auto reach_intervals = reader.read<std::vector<uint32_t>>();
+  auto reach_edge_offsets = reader.read<std::vector<uint32_t>>();
+  auto reach_edges = reader.read<std::vector<NodeId>>();
+
+  if (!reader.ok()) {
+    fatal("graph cache corrupted: truncated");
+  }
 
   // checks
   const size_t n = node_store.size();
   if (adjgraph.size() != n || reverse_adj.size() != n || names.size() != n ||
-      id_map.size() != n) {
+      pool_of.size() != n ||
+      grouped_ids.size() != grouped_outputs.size() ||
+      order_only_ids.size() != order_only_parents.size() ||
+      pool_names.size() != pool_depths.size() || template_of.size() != n ||
+      templates.size() != template_targets.size() || builtin.size() != n ||
+      !std::is_sorted(dyndeps.begin(), dyndeps.end()) ||
+      (!dyndeps.empty() && dyndeps.back() >= n)) {
     fatal("graph cache corrupted: size mismatch");
   }
 
-  if (ptr != buffer.data() + buffer.size()) {
+  if (!reader.at_end()) {
     fatal("graph cache corrupted: trailing bytes");
   }
 
+  // every stored id is used as an index without further checks
+  auto ids_valid = [n](const std::vector<NodeId> &ids) {
+    return std::all_of(ids.begin(), ids.end(),
+                       [n](NodeId id) { return id < n; });
+  };
+  auto lists_valid = [&](const std::vector<std::vector<NodeId>> &lists) {
+    return std::all_of(lists.begin(), lists.end(), ids_valid);
+  };
+  if (!lists_valid(adjgraph) || !lists_valid(reverse_adj)) {
+    fatal("graph cache corrupted: edges");
+  }
+  if (!ids_valid(phony)) {
+    fatal("graph cache corrupted: phony targets");
+  }
+  for (size_t i = 0; i < n; ++i) {
+    if (template_of[i] != no_template && template_of[i] >= templates.size()) {
+      fatal("graph cache corrupted: pattern recipes");
+    }
+    if (pool_of[i] != no_pool && pool_of[i] >= pool_names.size()) {
+      fatal("graph cache corrupted: pools");
+    }
+  }
+
+  std::unordered_map<NodeId, Node> grouped;
+  grouped.reserve(grouped_ids.size());
+  for (size_t i = 0; i < grouped_ids.size(); ++i) {
+    if (grouped_ids[i] >= n ||
+        !grouped.emplace(grouped_ids[i], std::move(grouped_outputs[i]))
+             .second) {
+      fatal("graph cache corrupted: grouped outputs");
+    }
+  }
+
+  // The shards depend on std::hash, which may differ between builds, so
+  // the index is rebuilt from the names rather than stored.
+  NameIndex id_map;
+  if (id_map.assign(names, worker_threads(n, min_rules_per_thread)) !=
+      NameIndex::npos) {
+    fatal("graph cache corrupted: duplicate name");
+  }
+  for (const auto &[id, outputs] : grouped) {
+    for (const auto &out : outputs) {
+      if (!id_map.emplace(out, id)) {
+        fatal("graph cache corrupted: duplicate name");
+      }
+    }
+  }
+  std::unordered_map<NodeId, std::vector<NodeId>> order_only;
+  order_only.reserve(order_only_ids.size());
+  for (size_t i = 0; i < order_only_ids.size(); ++i) {
+    if (order_only_ids[i] >= n || !ids_valid(order_only_parents[i])) {
+      fatal("graph cache corrupted: order-only edges");
+    }
+    order_only.emplace(order_only_ids[i], std::move(order_only_parents[i]));
+  }
+
+  ReachIndex reach(std::move(post), std::move(by_post),
+                   std::move(reach_offsets), std::move(reach_intervals),
+                   std::move(reach_edge_offsets), std::move(reach_edges));
+  if (!reach.empty() && !reach.consistent(n)) {
+    fatal("graph cache corrupted: reachability index");
+  }
+
   return Graph(std::move(node_store), std::move(adjgraph),
                std::move(reverse_adj), std::move(id_map),
                std::unordered_set(phony.begin(), phony.end()),
-               std::move(names));
+               std::move(names), std::move(pool_of), std::move(pool_names),
+               std::move(pool_depths), std::move(template_of),
+               std::move(templates), std::move(template_targets),
+               std::move(builtin), std::move(dyndeps), std::move(grouped),
+               std::move(order_only), std::move(reach));
+}
+
+void Graph::build_reach_index() { m_reach = ReachIndex::build(m_adjgraph); }
+
+// Post-order DFS over parents: every node comes after its dependencies.
+std::vector<NodeId> Graph::dependencies(std::span<const NodeId> ids) const {
+  constexpr uint8_t visited = 1, source = 2;
+  struct Frame {
+    NodeId u;
+    uint32_t next; // into parents, then order_only
+    std::span<const NodeId> parents, order_only;
+  };
+  std::vector<uint8_t> seen(size(), 0);
+  std::vector<NodeId> out;
+  std::vector<Frame> st;
+  auto enter = [&](NodeId u) {
+    st.push_back(Frame{u, 0, get_parent_ids(u), get_order_only_ids(u)});
+  };
+
+  for (NodeId id : ids)
+    seen[id] = source;
+  for (NodeId id : ids) {
+    enter(id);
+    while (!st.empty()) {
+      Frame &f = st.back();
+      if (f.next < f.parents.size() + f.order_only.size()) {
+        const NodeId p = f.next < f.parents.size()
+                             ? f.parents[f.next]
+                             : f.order_only[f.next - f.parents.size()];
+        f.next++;
+        if (!seen[p]) {
+          seen[p] = visited;
+          enter(p);
+        }
+        continue;
+      }
+      if (seen[f.u] != source)
+        out.push_back(f.u);
+      st.pop_back();
+    }
+  }
+  return out;
 }
 
-void Scheduler::run(const Graph &graph, const std::string &start) {
+void Scheduler::run(const Graph &graph, const std::string &start,
+                    std::span<const NodeId> prebuilt) {
+  stats::Scope phase(stats::Phase::Schedule);
   const NodeId N = static_cast<uint32_t>(graph.size());
 
   const NodeId start_id = graph.get_id(start);
@@ -155,6 +789,12 @@ void Scheduler::run(const Graph &graph, const std::string &start) {
     fatal(std::format("block: {} not available", start).c_str());
   }
 
+  // recorded duration, only looked up for the progress line
+  auto expected_wall_us = [&](NodeId u) -> uint64_t {
+    return m_history.empty() ? 0
+                             : m_history.expected_wall_us(*graph.get_name_ref(u));
+  };
+
   // 1. Compute required subgraph (reverse DFS)
   std::vector<uint8_t> needed(N, false);
   {
@@ -167,6 +807,9 @@ void Scheduler::run(const Graph &graph, const std::string &start) {
     while (!st.empty()) {
       NodeId u = st.back();
       st.pop_back();
+      if (m_progress) {
+        m_progress->add(expected_wall_us(u));
+      }
 
       for (NodeId p : graph.get_parent_ids(u)) {
         if (!needed[p]) {
@@ -174,12 +817,25 @@ void Scheduler::run(const Graph &graph, const std::string &start) {
           st.push_back(p);
         }
       }
+      for (NodeId p : graph.get_order_only_ids(u)) {
+        if (!needed[p]) {
+          needed[p] = true;
+          st.push_back(p);
+        }
+      }
+    }
+  }
+
+  std::vector<uint8_t> done_early;
+  if (!prebuilt.empty()) {
+    done_early.assign(N, 0);
+    for (NodeId u : prebuilt) {
+      done_early[u] = 1;
     }
   }
 
   // 2. Compute indegrees (restricted to needed subgraph)
   std::vector<uint32_t> indegree(N, 0);
-  std::queue<NodeId> ready;
 
   for (NodeId u = 0; u < N; ++u) {
     if (!needed[u])
@@ -192,25 +848,90 @@ void Scheduler::run(const Graph &graph, const std::string &start) {
     }
   }
 
-  // 3. Initialize ready queue
+  // 3. Priorities: with recorded durations, ready nodes are dispatched
+  // longest-path-to-goal first (critical path first). Without history
+  // every priority is 0 and the ready queue stays FIFO.
+  std::vector<uint64_t> blevel;
+  if (!m_history.empty()) {
+    blevel.assign(N, 0);
+
+    // topological order of the needed subgraph (Kahn)
+    std::vector<NodeId> order;
+    std::vector<uint32_t> deg(indegree);
+    for (NodeId i = 0; i < N; ++i) {
+      if (needed[i] && deg[i] == 0) {
+        order.push_back(i);
+      }
+    }
+    for (size_t k = 0; k < order.size(); ++k) {
+      for (NodeId v : graph.get_child_ids(order[k])) {
+        if (needed[v] && --deg[v] == 0) {
+          order.push_back(v);
+        }
+      }
+    }
+
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+      uint64_t longest_child = 0;
+      for (NodeId v : graph.get_child_ids(*it)) {
+        if (needed[v]) {
+          longest_child = std::max(longest_child, blevel[v]);
+        }
+      }
+      blevel[*it] =
+          m_history.expected_wall_us(*graph.get_name_ref(*it)) + longest_child;
+    }
+  }
+
+  struct ReadyEntry {
+    uint64_t priority;
+    uint64_t seq; // FIFO among equal priorities
+    NodeId id;
+  };
+  auto lower = [](const ReadyEntry &a, const ReadyEntry &b) {
+    return a.priority != b.priority ? a.priority < b.priority : a.seq > b.seq;
+  };
+  std::priority_queue<ReadyEntry, std::vector<ReadyEntry>, decltype(lower)>
+      ready(lower);
+  uint64_t ready_seq = 0;
+
+  auto push_ready = [&](NodeId u) {
+    ready.push(ReadyEntry{blevel.empty() ? 0 : blevel[u], ready_seq++, u});
+  };
+
   for (NodeId i = 0; i < N; ++i) {
     if (needed[i] && indegree[i] == 0) {
-      ready.push(i);
+      push_ready(i);
     }
   }
 
   // 4. Helper: should_execute(u)
   auto should_execute = [&](NodeId u) -> bool {
-    if (graph.is_phony(u)) {
+    stats::Scope check_phase(stats::Phase::StatChecks);
+    if (m_mode == RunMode::Simulate || graph.is_phony(u)) {
       return true;
     }
 
-    const std::string &target = *graph.get_name_ref(u);
+    // grouped rule: judged against its oldest output
+    const std::string *oldest = &*graph.get_name_ref(u);
+    std::error_code ec;
+    auto oldest_time = std::filesystem::last_write_time(*oldest, ec);
 
     // target does not exist → must execute
-    if (!std::filesystem::exists(target)) {
+    if (ec) {
       return true;
     }
+    for (const std::string &out : graph.get_grouped_outputs(u)) {
+      const auto t = std::filesystem::last_write_time(out, ec);
+      if (ec) {
+        return true;
+      }
+      if (t < oldest_time) {
+        oldest_time = t;
+        oldest = &out;
+      }
+    }
+    const std::string &target = *oldest;
 
     // any dependency newer → must execute
     for (NodeId p : graph.get_parent_ids(u)) {
@@ -219,59 +940,348 @@ void Scheduler::run(const Graph &graph, const std::string &start) {
         return true;
       }
     }
+    for (NodeId p : m_overlay.parents(u)) {
+      if (is_newer(*graph.get_name_ref(p), target)) {
+        return true;
+      }
+    }
+    for (const std::string &dep : m_overlay.inputs(u)) {
+      if (is_newer(dep, target)) {
+        return true;
+      }
+    }
 
     return false; // up-to-date
   };
 
-  // 5. Start process pool (prefork already done)
-  // start_pool();   // assuming pool already initialized
+  // Dynamic dependencies (.DYNDEP). A node's dyndep file is loaded when it
+  // is done, before its dependents are released; the new edges raise the
+  // indegree of their targets, which therefore must not have started yet.
+  // Ready entries whose indegree went back up are dropped when popped and
+  // pushed again once it reaches zero. Only tracked with dyndeps.
+  constexpr uint8_t dyn_started = 1, dyn_done = 2;
+  std::vector<uint8_t> dyn_state;
+  m_overlay = {};
+  if (graph.has_dyndeps()) {
+    dyn_state.assign(N, 0);
+  }
+
+  // A dyndep prerequisite outside the goal's closure (e.g. a generated
+  // module found by a scanner) joins the build with its own closure. The
+  // new nodes count their pending prerequisites like step 2, taken from
+  // the child lists of all their ancestors: with --optimize-graph a
+  // scheduling edge can come from any of them, not just a direct parent.
+  // They inherit the priority of the target that asked for them.
+  constexpr uint8_t pulled_new = 1, pulled_ancestor = 2;
+  std::vector<uint8_t> pulled; // reset after each pull_in
+  auto pull_in = [&](NodeId p, NodeId target) {
+    if (pulled.empty()) {
+      pulled.assign(N, 0);
+    }
+    std::vector<NodeId> added{p};
+    needed[p] = true;
+    pulled[p] = pulled_new;
+    for (size_t k = 0; k < added.size(); ++k) {
+      const NodeId u = added[k];
+      if (m_progress) {
+        m_progress->add(expected_wall_us(u));
+      }
+      for (NodeId q : graph.get_parent_ids(u)) {
+        if (!needed[q]) {
+          needed[q] = true;
+          pulled[q] = pulled_new;
+          added.push_back(q);
+        }
+      }
+      for (NodeId q : graph.get_order_only_ids(u)) {
+        if (!needed[q]) {
+          needed[q] = true;
+          pulled[q] = pulled_new;
+          added.push_back(q);
+        }
+      }
+    }
+
+    std::vector<NodeId> seen(added);
+    for (size_t k = 0; k < seen.size(); ++k) {
+      const NodeId u = seen[k];
+      for (NodeId q : graph.get_parent_ids(u)) {
+        if (pulled[q] == 0) {
+          pulled[q] = pulled_ancestor;
+          seen.push_back(q);
+        }
+      }
+      for (NodeId q : graph.get_order_only_ids(u)) {
+        if (pulled[q] == 0) {
+          pulled[q] = pulled_ancestor;
+          seen.push_back(q);
+        }
+      }
+    }
+    for (NodeId q : seen) {
+      if (dyn_state[q] == dyn_done) {
+        continue;
+      }
+      for (NodeId v : graph.get_child_ids(q)) {
+        if (pulled[v] == pulled_new) {
+          indegree[v]++;
+        }
+      }
+    }
+
+    for (NodeId u : added) {
+      if (!blevel.empty()) {
+        blevel[u] = blevel[target] +
+                    m_history.expected_wall_us(*graph.get_name_ref(u));
+      }
+      if (indegree[u] == 0) {
+        push_ready(u);
+      }
+    }
+    for (NodeId q : seen) {
+      pulled[q] = 0;
+    }
+  };
+
+  auto load_dyndep = [&](NodeId u) {
+    const std::string &path = *graph.get_name_ref(u);
+    if (m_mode == RunMode::Simulate && !std::filesystem::exists(path)) {
+      return; // never written: nothing to add
+    }
+    for (const auto &rule : DyndepOverlay::read(path)) {
+      const NodeId t = graph.get_id(rule.name);
+      if (t == Graph::npos || !needed[t]) {
+        fatal(std::format("dyndep: {}: {} is not part of this build", path,
+                          rule.name)
+                  .c_str());
+      }
+      if (dyn_state[t] != 0) {
+        fatal(std::format("dyndep: {}: {} already started (it should depend "
+                          "on {})",
+                          path, rule.name, path)
+                  .c_str());
+      }
+      for (const auto &dep : rule.deps) {
+        const NodeId p = graph.get_id(dep);
+        if (p == Graph::npos) {
+          m_overlay.add_input(t, dep);
+          continue;
+        }
+        if (!needed[p]) {
+          pull_in(p, t);
+        }
+        m_overlay.add_edge(p, t);
+        if (dyn_state[p] != dyn_done) {
+          indegree[t]++;
+        }
+      }
+    }
+  };
+
+  // Propagate completion
+  auto complete = [&](NodeId u) {
+    if (!dyn_state.empty()) {
+      dyn_state[u] = dyn_done;
+      for (NodeId v : m_overlay.children(u)) {
+        if (--indegree[v] == 0) {
+          push_ready(v);
+        }
+      }
+      if (graph.is_dyndep(u)) {
+        load_dyndep(u);
+      }
+    }
+    for (NodeId v : graph.get_child_ids(u)) {
+      if (needed[v] && --indegree[v] == 0) {
+        push_ready(v);
+      }
+    }
+  };
+
+  // 5. Executor is started by the caller
 
   uint32_t running = 0;
 
+  // Admission control. A node that needs to run can still be held back:
+  //  - resource pools: its pool is saturated; it waits in that pool's queue
+  //    and is released when a job of the same pool finishes.
+  //  - memory: its expected peak RSS would push the running set past the
+  //    budget, or memory pressure is above the threshold; it waits until
+  //    any job finishes.
+  // Held nodes don't block other ready work. Released nodes go to
+  // `admitted`, they are already known to need execution. Nothing is held
+  // back while the pool is idle, so oversized jobs still make progress.
+  std::vector<uint32_t> pool_running(graph.pool_count(), 0);
+  std::vector<std::queue<NodeId>> pool_waiting(graph.pool_count());
+  std::queue<NodeId> mem_waiting;
+  std::queue<NodeId> admitted;
+  uint64_t running_rss_kb = 0;
+
+  auto expected_rss_kb = [&](NodeId u) -> uint64_t {
+    return m_history.expected_rss_kb(*graph.get_name_ref(u));
+  };
+
+  // Batching. Jobs known to be tiny (measured below batch_threshold_us, no
+  // resource pool) collect in `batch` instead of taking a slot each; the
+  // batch goes out as one submit_batch() when it is full, before any other
+  // job is submitted and before waiting. It is sized so the ready work
+  // still spreads over all slots. Results come back per job, so failures
+  // and history stay attributed to the exact node.
+  const size_t batch_capacity =
+      m_mode == RunMode::Build ? m_executor.batch_capacity() : 1;
+  std::vector<BatchJob> batch;
+
+  auto batchable = [&](NodeId u) {
+    const std::string &name = *graph.get_name_ref(u);
+    return batch_capacity > 1 && graph.get_pool(u) == Graph::no_pool &&
+           m_history.measured(name) &&
+           m_history.expected_wall_us(name) < batch_threshold_us;
+  };
+
+  auto flush_batch = [&] {
+    if (!batch.empty()) {
+      m_executor.submit_batch(batch);
+      batch.clear();
+    }
+  };
+
+  auto admit = [&](NodeId u) {
+    const PoolId p = graph.get_pool(u);
+    if (p != Graph::no_pool && pool_running[p] >= graph.get_pool_depth(p)) {
+      pool_waiting[p].push(u);
+      return;
+    }
+
+    const uint64_t rss = expected_rss_kb(u);
+    if (running > 0 &&
+        ((m_limits.mem_budget_kb != 0 &&
+          running_rss_kb + rss > m_limits.mem_budget_kb) ||
+         (m_limits.mem_psi_avg10 > 0 &&
+          m_pressure.avg10() > m_limits.mem_psi_avg10))) {
+      mem_waiting.push(u);
+      return;
+    }
+
+    const bool tiny = batchable(u);
+    if (!tiny && !batch.empty()) {
+      flush_batch();
+      if (!m_executor.can_accept()) {
+        admitted.push(u); // the batch took the last slot
+        return;
+      }
+    }
+
+    if (p != Graph::no_pool) {
+      pool_running[p]++;
+    }
+    running_rss_kb += rss;
+    if (tiny) {
+      batch.push_back(BatchJob{u,
+                               graph.is_templated(u)
+                                   ? graph.expand_recipe(u)
+                                   : *graph.get_command_ref(u),
+                               graph.is_builtin(u)});
+      const size_t target =
+          std::min(batch_capacity, 1 + ready.size() / m_executor.slots());
+      if (batch.size() >= target) {
+        flush_batch();
+      }
+    } else if (graph.is_templated(u)) {
+      m_executor.submit(u, graph.expand_recipe(u), graph.is_builtin(u));
+    } else {
+      m_executor.submit(u, *graph.get_command_ref(u), graph.is_builtin(u));
+    }
+    running++;
+    if (m_progress) {
+      m_progress->started();
+    }
+  };
+
   // 6. Main scheduling loop
-  while (!ready.empty() || running > 0) {
+  while (!ready.empty() || !admitted.empty() || running > 0) {
 
     // Dispatch while capacity available
-    while (!ready.empty() && pool.can_accept()) {
-      NodeId u = ready.front();
+    while (!admitted.empty() && m_executor.can_accept()) {
+      NodeId u = admitted.front();
+      admitted.pop();
+      admit(u);
+    }
+
+    while (!ready.empty() && m_executor.can_accept()) {
+      NodeId u = ready.top().id;
       ready.pop();
+      if (!dyn_state.empty()) {
+        if (dyn_state[u] != 0 || indegree[u] != 0) {
+          continue;
+        }
+        dyn_state[u] = dyn_started;
+      }
 
-      if (should_execute(u)) {
-        const Node &node = *graph.get_command_ref(u);
-        pool.submit(u, node);
-        running++;
+      if ((done_early.empty() || !done_early[u]) && should_execute(u) &&
+          graph.has_recipe(u)) {
+        admit(u);
       } else {
-        // skipped node → instant success
-        for (NodeId v : graph.get_child_ids(u)) {
-          if (needed[v] && --indegree[v] == 0) {
-            ready.push(v);
-          }
+        // skipped node or empty recipe → instant success
+        if (m_progress) {
+          m_progress->skipped(expected_wall_us(u));
         }
+        complete(u);
       }
     }
+    flush_batch();
 
     // If nothing running, continue draining ready
     if (running == 0)
       continue;
 
+    if (m_progress) {
+      m_progress->tick();
+    }
+
     // Wait for one task to finish
-    auto res = pool.wait_result();
+    auto res = m_executor.wait_result();
     running--;
 
+    running_rss_kb -= expected_rss_kb(res.node_id);
+    if (m_progress) {
+      m_progress->finished(expected_wall_us(res.node_id), res.wall_us);
+      m_progress->tick();
+    }
+    if (m_mode == RunMode::Build) {
+      m_history.record(*graph.get_name_ref(res.node_id), res);
+    }
+
     if (res.exit_code != 0) {
-      pool.shutdown();
+      if (m_progress) {
+        m_progress->done();
+      }
+      m_executor.shutdown();
+      if (m_mode == RunMode::Build) {
+        m_history.save();
+      }
       fatal("command failed");
     }
 
-    // Propagate completion
-    for (NodeId v : graph.get_child_ids(res.node_id)) {
-      if (needed[v] && --indegree[v] == 0) {
-        ready.push(v);
+    if (const PoolId p = graph.get_pool(res.node_id); p != Graph::no_pool) {
+      pool_running[p]--;
+      if (!pool_waiting[p].empty()) {
+        admitted.push(pool_waiting[p].front());
+        pool_waiting[p].pop();
       }
     }
+
+    while (!mem_waiting.empty()) {
+      admitted.push(mem_waiting.front());
+      mem_waiting.pop();
+    }
+
+    complete(res.node_id);
   }
 
-  pool.shutdown();
+  m_executor.shutdown();
+  if (m_progress) {
+    m_progress->done();
+  }
 
   // Cycle detection (needed subgraph only)
   for (NodeId i = 0; i < N; ++i) {
@@ -1,13 +1,22 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
+#include <dyndep.hpp>
 #include <fstream>
+#include <graph_optimize.hpp>
+#include <history.hpp>
+#include <name_index.hpp>
 #include <numeric>
 #include <optional>
 #include <parse.hpp>
-#include <process_pool.hpp>
+#include <progress.hpp>
+#include <reach_index.hpp>
+#include <executor.hpp>
 #include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <utils.hpp>
@@ -19,20 +28,50 @@ constexpr std::string default_cmd = "_default";
 constexpr uint32_t default_procs = 2;
 using Node = std::vector<std::string>;
 using NodeId = uint32_t;
+using PoolId = uint32_t;
+
+// "%.o" against "dir/foo.o" => "dir/foo" (stems are never empty)
+std::optional<std::string_view> match_pattern(std::string_view pattern,
+                                              std::string_view name);
 
 class Graph {
 public:
   static constexpr NodeId npos = std::numeric_limits<NodeId>::max();
+  static constexpr PoolId no_pool = std::numeric_limits<PoolId>::max();
+  static constexpr uint32_t no_template = std::numeric_limits<uint32_t>::max();
   static constexpr std::string serialize_file = ".graph_cache";
-  static constexpr uint32_t GRAPH_SERDE_VERSION = 1;
+  static constexpr uint32_t GRAPH_SERDE_VERSION = 12;
   Graph() = delete;
 
-  static Graph build(const parse::Result &parsed);
+  // optimize: run the edge optimization pass and report what it removed
+  static Graph build(const parse::Result &parsed,
+                     OptimizeStats *optimize = nullptr);
 
+  // explicit recipe; empty for pattern instances (see expand_recipe)
   inline Ref<const Node> get_command_ref(NodeId node_id) const noexcept {
     return Ref<const Node>{&m_node_store[node_id]};
   }
 
+  inline bool is_templated(NodeId node_id) const noexcept {
+    return m_template_of[node_id] != no_template;
+  }
+
+  // recipe of a pattern instance with $@ $< $^ $| $* and $$ expanded
+  Node expand_recipe(NodeId node_id) const;
+
+  inline bool has_recipe(NodeId node_id) const noexcept {
+    const uint32_t t = m_template_of[node_id];
+    return t == no_template ? !m_node_store[node_id].empty()
+                            : !m_templates[t].empty();
+  }
+
+  // every recipe line is a builtin:: form (decided at build time)
+  inline bool is_builtin(NodeId node_id) const noexcept {
+    return m_builtin[node_id] != 0;
+  }
+
+  // scheduling edges; with the optimization pass this can be a subset of
+  // the transposed parent lists
   inline std::span<const NodeId> get_child_ids(NodeId node_id) const noexcept {
     const auto &v = m_adjgraph[node_id];
     return {v.data(), v.size()};
@@ -43,13 +82,19 @@ public:
     return {v.data(), v.size()};
   }
 
-  inline NodeId get_id(const std::string &name) const noexcept {
-    auto id = this->m_id_map.find(name);
-    if (id == this->m_id_map.end()) {
-      return Graph::npos;
-    } else {
-      return id->second;
+  // order-only prerequisites (`| deps`): scheduling edges that are neither
+  // parents for mtime checks nor part of $< / $^
+  inline std::span<const NodeId>
+  get_order_only_ids(NodeId node_id) const noexcept {
+    auto it = m_order_only.find(node_id);
+    if (it == m_order_only.end()) {
+      return {};
     }
+    return {it->second.data(), it->second.size()};
+  }
+
+  inline NodeId get_id(const std::string &name) const noexcept {
+    return this->m_id_map.find(name);
   }
 
   inline Ref<const std::string> get_name_ref(NodeId id) const noexcept {
@@ -58,45 +103,167 @@ public:
 
   inline std::size_t size() const noexcept { return m_node_store.size(); }
 
+  // further outputs of a grouped rule; the node is named after the first
+  inline std::span<const std::string>
+  get_grouped_outputs(NodeId id) const noexcept {
+    auto it = m_grouped.find(id);
+    if (it == m_grouped.end()) {
+      return {};
+    }
+    return {it->second.data(), it->second.size()};
+  }
+
   inline bool is_phony(const NodeId id) const noexcept {
     return (m_phony.find(id) != m_phony.end());
   }
 
+  // its recipe writes a dyndep file (.DYNDEP)
+  inline bool is_dyndep(const NodeId id) const noexcept {
+    return std::binary_search(m_dyndeps.begin(), m_dyndeps.end(), id);
+  }
+
+  inline bool has_dyndeps() const noexcept { return !m_dyndeps.empty(); }
+
+  inline PoolId get_pool(const NodeId id) const noexcept {
+    return m_pool_of[id];
+  }
+
+  inline std::size_t pool_count() const noexcept {
+    return m_pool_depths.size();
+  }
+
+  inline uint32_t get_pool_depth(const PoolId pool) const noexcept {
+    return m_pool_depths[pool];
+  }
+
+  // The reachability index is only built for queries (and by
+  // --optimize-graph, which needs it); the cache keeps it once built.
+  inline bool has_reach_index() const noexcept { return !m_reach.empty(); }
+  void build_reach_index();
+
+  // targets that transitively depend on any of `ids` (not `ids`
+  // themselves), dependencies before dependents; needs the reach index
+  inline std::vector<NodeId> dependents(std::span<const NodeId> ids) const {
+    return m_reach.descendants(ids);
+  }
+
+  // everything `ids` transitively depend on, in build order
+  std::vector<NodeId> dependencies(std::span<const NodeId> ids) const;
+
   void serialize() const;
   static Graph deserialize();
+  // the cache exists and was written with this GRAPH_SERDE_VERSION
+  static bool cache_current();
 
 private:
   explicit Graph(std::vector<Node> &&node_store,
                  std::vector<std::vector<NodeId>> &&adjgraph,
                  std::vector<std::vector<NodeId>> &&revgraph,
-                 std::unordered_map<std::string, uint32_t> &&id_map,
+                 NameIndex &&id_map,
                  std::unordered_set<NodeId> &&phony,
-                 std::vector<std::string> &&names)
+                 std::vector<std::string> &&names,
+                 std::vector<PoolId> &&pool_of,
+                 std::vector<std::string> &&pool_names,
+                 std::vector<uint32_t> &&pool_depths,
+                 std::vector<uint32_t> &&template_of,
+                 std::vector<Node> &&templates,
+                 std::vector<std::string> &&template_targets,
+                 std::vector<uint8_t> &&builtin,
+                 std::vector<NodeId> &&dyndeps,
+                 std::unordered_map<NodeId, Node> &&grouped,
+                 std::unordered_map<NodeId, std::vector<NodeId>> &&order_only,
+                 ReachIndex &&reach)
       : m_node_store(std::move(node_store)), m_adjgraph(std::move(adjgraph)),
         m_reverse_adj(std::move(revgraph)), m_id_map(std::move(id_map)),
-        m_phony(std::move(phony)), m_names(std::move(names)) {}
+        m_phony(std::move(phony)), m_names(std::move(names)),
+        m_pool_of(std::move(pool_of)), m_pool_names(std::move(pool_names)),
+        m_pool_depths(std::move(pool_depths)),
+        m_template_of(std::move(template_of)),
+        m_templates(std::move(templates)),
+        m_template_targets(std::move(template_targets)),
+        m_builtin(std::move(builtin)), m_dyndeps(std::move(dyndeps)),
+        m_grouped(std::move(grouped)), m_order_only(std::move(order_only)),
+        m_reach(std::move(reach)) {}
 
   const std::vector<Node> m_node_store;
   const std::vector<std::vector<NodeId>> m_adjgraph;
   const std::vector<std::vector<NodeId>> m_reverse_adj;
-  const std::unordered_map<std::string, uint32_t> m_id_map;
+  const NameIndex m_id_map;
   const std::unordered_set<NodeId> m_phony;
   const std::vector<std::string> m_names;
+  // resource pools: per-node pool (or no_pool) and per-pool name/depth
+  const std::vector<PoolId> m_pool_of;
+  const std::vector<std::string> m_pool_names;
+  const std::vector<uint32_t> m_pool_depths;
+  // pattern rules: per-node template (or no_template), template recipes
+  // and their target patterns ("%.o")
+  const std::vector<uint32_t> m_template_of;
+  const std::vector<Node> m_templates;
+  const std::vector<std::string> m_template_targets;
+  const std::vector<uint8_t> m_builtin;
+  // sorted
+  const std::vector<NodeId> m_dyndeps;
+  // grouped rules: extra outputs, each also in m_id_map
+  const std::unordered_map<NodeId, Node> m_grouped;
+  // order-only parents; the edges are in m_adjgraph as well
+  const std::unordered_map<NodeId, std::vector<NodeId>> m_order_only;
+  // reverse-dependency queries (buildir --query), empty until built
+  ReachIndex m_reach;
 };
 
-class Scheduler {
+struct MemoryLimits {
+  uint64_t mem_budget_kb = 0; // 0 => unlimited
+  double mem_psi_avg10 = 0;   // "some" avg10 percentage, 0 => ignored
+};
+
+// Memory PSI of our cgroup (or the whole system), re-read at most every
+// refresh_interval so it can be polled from the dispatch loop.
+class MemoryPressure {
 public:
-  Scheduler(uint32_t n_workers) : pool(n_workers) {}
+  static constexpr auto refresh_interval = std::chrono::milliseconds(200);
 
-  inline void start_pool() { pool.start(); }
-  void run(const Graph &graph, const std::string &start);
+  double avg10();
 
 private:
-  inline void execute_node(NodeId id, const Node &node) {
-    pool.submit(id, node);
-  }
+  void resolve_path();
 
-  ProcessPool pool;
+  bool m_resolved = false;
+  std::string m_path;
+  std::chrono::steady_clock::time_point m_last_read{};
+  double m_avg10 = 0;
+};
+
+// Simulate: every needed node is treated as out of date (nothing is
+// stat'ed) and results are not recorded into the build history.
+enum class RunMode : uint8_t { Build, Simulate };
+
+class Scheduler {
+public:
+  Scheduler(Executor &executor, BuildHistory &history, MemoryLimits limits = {},
+            RunMode mode = RunMode::Build, Progress *progress = nullptr)
+      : m_executor(executor), m_history(history), m_limits(limits),
+        m_mode(mode), m_progress(progress) {}
+
+  // prebuilt: nodes already brought up to date (see StreamBuild), taken
+  // as done without being checked
+  void run(const Graph &graph, const std::string &start,
+           std::span<const NodeId> prebuilt = {});
+
+  // edges loaded from dyndep files during run()
+  inline const DyndepOverlay &overlay() const noexcept { return m_overlay; }
+
+  // Jobs recorded as faster than this are handed to a worker several at a
+  // time (Executor::submit_batch) when there is enough ready work.
+  static constexpr uint64_t batch_threshold_us = 2000;
+
+private:
+  Executor &m_executor;
+  BuildHistory &m_history;
+  MemoryLimits m_limits;
+  RunMode m_mode;
+  Progress *m_progress; // optional status line
+  MemoryPressure m_pressure;
+  DyndepOverlay m_overlay;
 };
 
 } // namespace exec
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace exec {
+
+using NodeId = uint32_t;
+using Node = std::vector<std::string>;
+
+// Resource usage is summed over the node's commands (peak for RSS).
+struct ResultMsg {
+  NodeId node_id;
+  int32_t exit_code;
+  uint64_t wall_us;
+  uint64_t user_us;
+  uint64_t sys_us;
+  uint64_t max_rss_kb;
+  uint64_t inblock; // filesystem input/output operations
+  uint64_t oublock;
+};
+
+struct BatchJob {
+  NodeId id;
+  Node commands;
+  bool builtin;
+};
+
+// What Scheduler::run dispatches to: ProcessPool runs the commands,
+// SimExecutor replays durations on a virtual clock.
+class Executor {
+public:
+  virtual ~Executor() = default;
+
+  virtual bool can_accept() const = 0;
+  virtual size_t slots() const = 0; // jobs (or batches) at a time
+
+  // builtin: every command is expected to be a builtin:: form
+  virtual void submit(NodeId id, const Node &commands, bool builtin) = 0;
+  virtual ResultMsg wait_result() = 0; // blocking
+
+  // Jobs that one submit_batch() may carry; 1 => no batching.
+  virtual size_t batch_capacity() const { return 1; }
+  // Runs `jobs` one after another in a single slot, at most
+  // batch_capacity() of them. Each still gets its own ResultMsg from
+  // wait_result(). Jobs after a failing one may be skipped; they are then
+  // reported as failed (exit_code -1).
+  virtual void submit_batch(std::span<const BatchJob> jobs) {
+    for (const auto &job : jobs) {
+      submit(job.id, job.commands, job.builtin);
+    }
+  }
+
+  virtual void shutdown() = 0; // safe to call multiple times
+};
+
+} // namespace exec
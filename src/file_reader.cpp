@@ -5,11 +5,17 @@
 FileReader::FileReader(std::string path) : m_path(std::move(path)) {}
 
 std::vector<std::string> FileReader::read_lines() const {
+  std::vector<std::string> lines;
+  for_each_line([&lines](std::string &line) { lines.push_back(line); });
+  return lines;
+}
+
+void FileReader::for_each_line(
+    const std::function<void(std::string &)> &fn) const {
   std::ifstream file(m_path);
   if (!file) {
     fatal("failed to open file");
   }
-  std::vector<std::string> lines;
   std::string line;
 
   while (std::getline(file, line)) {
@@ -27,9 +33,7 @@ std::vector<std::string> FileReader::read_lines() const {
     }
 
     if (!line.empty()) {
-      lines.push_back(line);
+      fn(line);
     }
   }
-
-  return lines;
 }
@@ -1,4 +1,5 @@
 #pragma once
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -6,6 +7,8 @@ class FileReader {
 public:
   explicit FileReader(std::string path);
   std::vector<std::string> read_lines() const;
+  // same lines as read_lines(), handed out as they are read
+  void for_each_line(const std::function<void(std::string &)> &fn) const;
 
 private:
   std::string m_path;
@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fingerprint.hpp>
+#include <fstream>
+#include <iostream>
+#include <serde_utils.hpp>
+#include <thread>
+
+namespace exec {
+
+namespace {
+
+// ns since the filesystem clock epoch, nullopt if the file is gone
+std::optional<int64_t> mtime_of(const std::string &path) {
+  std::error_code ec;
+  const auto t = std::filesystem::last_write_time(path, ec);
+  if (ec) {
+    return std::nullopt;
+  }
+  return static_cast<int64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          t.time_since_epoch())
+          .count());
+}
+
+} // namespace
+
+// On disk: version, goal names, then per goal its paths and mtimes.
+
+Fingerprints Fingerprints::load() {
+  namespace fs = std::filesystem;
+
+  Fingerprints fp;
+  std::error_code ec;
+  const auto filesize = fs::file_size(fingerprint_file, ec);
+  if (ec || filesize < sizeof(uint32_t)) {
+    return fp;
+  }
+
+  std::ifstream in(fingerprint_file, std::ios::binary);
+  std::vector<std::byte> buffer(filesize);
+  in.read(reinterpret_cast<char *>(buffer.data()),
+          static_cast<std::streamsize>(buffer.size()));
+  if (!in) {
+    return fp;
+  }
+
+  serde::Reader reader(buffer);
+  if (reader.read<uint32_t>() != FINGERPRINT_SERDE_VERSION) {
+    return fp;
+  }
+  auto goals = reader.read<std::vector<std::string>>();
+  auto paths = reader.read<std::vector<std::vector<std::string>>>();
+  auto mtimes = reader.read<std::vector<std::vector<int64_t>>>();
+  if (!reader.at_end() || paths.size() != goals.size() ||
+      mtimes.size() != goals.size()) {
+    return fp;
+  }
+
+  for (size_t i = 0; i < goals.size(); ++i) {
+    if (paths[i].size() != mtimes[i].size()) {
+      return Fingerprints{};
+    }
+    fp.m_goals.emplace(std::move(goals[i]),
+                       Entry{std::move(paths[i]), std::move(mtimes[i])});
+  }
+  return fp;
+}
+
+void Fingerprints::save() const {
+  std::vector<std::string> goals;
+  std::vector<std::vector<std::string>> paths;
+  std::vector<std::vector<int64_t>> mtimes;
+  for (const auto &[goal, entry] : m_goals) {
+    goals.push_back(goal);
+    paths.push_back(entry.paths);
+    mtimes.push_back(entry.mtimes);
+  }
+
+  const auto bytestream =
+      serde::serialize_all(FINGERPRINT_SERDE_VERSION, goals, paths, mtimes);
+  std::ofstream out(fingerprint_file, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char *>(bytestream.data()),
+            static_cast<std::streamsize>(bytestream.size()));
+  if (!out) {
+    std::cerr << "failed to write build fingerprint\n";
+  }
+}
+
+bool Fingerprints::is_clean(const std::string &goal) const {
+  auto it = m_goals.find(goal);
+  if (it == m_goals.end()) {
+    return false;
+  }
+  const Entry &entry = it->second;
+
+  std::atomic<bool> clean = true;
+  auto check = [&entry, &clean](size_t first, size_t last) {
+    for (size_t i = first; i < last && clean.load(std::memory_order_relaxed);
+         ++i) {
+      if (mtime_of(entry.paths[i]) != entry.mtimes[i]) {
+        clean.store(false, std::memory_order_relaxed);
+      }
+    }
+  };
+
+  const size_t n = entry.paths.size();
+  const size_t threads =
+      n < parallel_threshold
+          ? 1
+          : std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+                             n / (parallel_threshold / 4));
+  if (threads <= 1) {
+    check(0, n);
+    return clean;
+  }
+
+  {
+    std::vector<std::jthread> workers;
+    const size_t per = (n + threads - 1) / threads;
+    for (size_t first = 0; first < n; first += per) {
+      workers.emplace_back(check, first, std::min(n, first + per));
+    }
+  }
+  return clean;
+}
+
+void Fingerprints::record(const Graph &graph, NodeId goal,
+                          const std::string &makefile,
+                          const DyndepOverlay &overlay) {
+  m_goals.erase(*graph.get_name_ref(goal));
+
+  // Dyndep prerequisites that are nodes may lie outside the goal's static
+  // closure (the scheduler pulls them in), so their closures count too;
+  // their edges matter for the staleness check below. Other dyndep
+  // prerequisites are inputs.
+  auto roots = overlay.all_sources();
+  roots.push_back(goal);
+  std::sort(roots.begin(), roots.end());
+  roots.erase(std::unique(roots.begin(), roots.end()), roots.end());
+  auto nodes = graph.dependencies(roots);
+  nodes.insert(nodes.end(), roots.begin(), roots.end());
+  const auto inputs = overlay.all_inputs();
+
+  Entry entry;
+  entry.paths.reserve(nodes.size() + inputs.size() + 1);
+  entry.mtimes.reserve(nodes.size() + inputs.size() + 1);
+
+  auto add = [&entry](const std::string &path) {
+    const auto mtime = mtime_of(path);
+    if (!mtime) {
+      return false;
+    }
+    entry.paths.push_back(path);
+    entry.mtimes.push_back(*mtime);
+    return true;
+  };
+
+  if (!add(makefile)) {
+    return;
+  }
+  for (const auto &path : inputs) {
+    if (!add(path)) {
+      return;
+    }
+  }
+  std::unordered_map<NodeId, int64_t> mtime;
+  mtime.reserve(nodes.size());
+  for (NodeId u : nodes) {
+    if (graph.is_phony(u)) {
+      if (graph.has_recipe(u)) {
+        return; // runs every time
+      }
+      continue;
+    }
+    if (!add(*graph.get_name_ref(u))) {
+      return; // would be rebuilt next time anyway
+    }
+    int64_t oldest = entry.mtimes.back();
+    for (const auto &out : graph.get_grouped_outputs(u)) {
+      if (!add(out)) {
+        return;
+      }
+      oldest = std::min(oldest, entry.mtimes.back());
+    }
+    mtime.emplace(u, oldest);
+  }
+
+  // same test as the scheduler: a recipe whose target is older than one of
+  // its prerequisites runs again next time
+  for (const auto &[u, t] : mtime) {
+    if (!graph.has_recipe(u)) {
+      continue;
+    }
+    auto newer = [&](NodeId p) {
+      auto it = mtime.find(p);
+      const auto tp = it != mtime.end() ? std::optional(it->second)
+                                        : mtime_of(*graph.get_name_ref(p));
+      return tp && *tp > t;
+    };
+    const auto parents = graph.get_parent_ids(u);
+    const auto dyn_parents = overlay.parents(u);
+    const auto dyn_inputs = overlay.inputs(u);
+    if (std::any_of(parents.begin(), parents.end(), newer) ||
+        std::any_of(dyn_parents.begin(), dyn_parents.end(), newer) ||
+        std::any_of(dyn_inputs.begin(), dyn_inputs.end(),
+                    [t](const std::string &path) {
+                      const auto tp = mtime_of(path);
+                      return tp && *tp > t;
+                    })) {
+      return;
+    }
+  }
+
+  m_goals.emplace(*graph.get_name_ref(goal), std::move(entry));
+}
+
+} // namespace exec
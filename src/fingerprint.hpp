@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <exec.hpp>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace exec {
+
+// Per goal: every file of its last successful build (the Makefile, sources
+// and targets) with its mtime. If none of them changed, the goal is still
+// up to date and the build can stop before the graph is even loaded.
+class Fingerprints {
+public:
+  static constexpr std::string fingerprint_file = ".fingerprints";
+  static constexpr uint32_t FINGERPRINT_SERDE_VERSION = 1;
+  // below this many files the check runs on the calling thread
+  static constexpr size_t parallel_threshold = 4096;
+
+  // Missing, outdated or corrupted fingerprints are just empty.
+  static Fingerprints load();
+  void save() const;
+
+  // mtimes are stat'ed in parallel; false if anything differs or is gone
+  bool is_clean(const std::string &goal) const;
+
+  // After a successful build of `goal`. Goals that always run something
+  // (phony targets with a recipe) or whose targets weren't produced get
+  // no fingerprint. `overlay`: the dyndep edges and inputs of the build.
+  void record(const Graph &graph, NodeId goal, const std::string &makefile,
+              const DyndepOverlay &overlay = {});
+
+private:
+  struct Entry {
+    std::vector<std::string> paths;
+    std::vector<int64_t> mtimes;
+  };
+
+  std::unordered_map<std::string, Entry> m_goals;
+};
+
+} // namespace exec
@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <graph_optimize.hpp>
+#include <limits>
+#include <map>
+
+namespace exec {
+
+size_t dedupe_edges(std::vector<std::vector<uint32_t>> &lists) {
+  // stamp[v] == u + 1 => v already seen in list u
+  std::vector<uint32_t> stamp(lists.size(), 0);
+  size_t removed = 0;
+  for (size_t u = 0; u < lists.size(); ++u) {
+    const auto mark = static_cast<uint32_t>(u + 1);
+    auto &list = lists[u];
+    const size_t before = list.size();
+    std::erase_if(list, [&](uint32_t v) {
+      if (stamp[v] == mark)
+        return true;
+      stamp[v] = mark;
+      return false;
+    });
+    removed += before - list.size();
+  }
+  return removed;
+}
+
+namespace {
+
+constexpr uint32_t none = std::numeric_limits<uint32_t>::max();
+
+// disjoint, merged [lo, hi] intervals
+class IntervalSet {
+public:
+  bool contains(uint32_t p) const {
+    auto it = m_set.upper_bound(p);
+    return it != m_set.begin() && std::prev(it)->second >= p;
+  }
+
+  void insert(uint32_t lo, uint32_t hi) {
+    auto it = m_set.upper_bound(lo);
+    if (it != m_set.begin() && std::prev(it)->second + 1 >= lo) {
+      --it;
+      lo = it->first;
+    }
+    while (it != m_set.end() && it->first <= hi + 1) {
+      hi = std::max(hi, it->second);
+      it = m_set.erase(it);
+    }
+    m_set.emplace(lo, hi);
+  }
+
+  void clear() { m_set.clear(); }
+
+private:
+  std::map<uint32_t, uint32_t> m_set;
+};
+
+} // namespace
+
+void optimize_schedule(std::vector<std::vector<uint32_t>> &adj,
+                       const std::vector<uint8_t> &alias,
+                       const ReachIndex &reach, OptimizeStats &stats) {
+  const auto n = static_cast<uint32_t>(adj.size());
+
+  // single scheduling prerequisite of each node (or none)
+  std::vector<uint32_t> indeg(n, 0);
+  std::vector<uint32_t> only_parent(n, none);
+  for (uint32_t u = 0; u < n; ++u) {
+    for (uint32_t v : adj[u]) {
+      only_parent[v] = indeg[v]++ == 0 ? u : none;
+    }
+  }
+
+  // 1. alias bypass, prerequisites first so chains end up on their root
+  std::vector<uint32_t> order;
+  order.reserve(n);
+  {
+    std::vector<uint32_t> deg(indeg);
+    for (uint32_t i = 0; i < n; ++i)
+      if (deg[i] == 0)
+        order.push_back(i);
+    for (size_t k = 0; k < order.size(); ++k)
+      for (uint32_t v : adj[order[k]])
+        if (--deg[v] == 0)
+          order.push_back(v);
+  }
+
+  // bypassed aliases keep no scheduling dependents, so their labels no
+  // longer describe the scheduling graph
+  std::vector<uint8_t> bypassed(n, 0);
+  for (uint32_t p : order) {
+    const uint32_t q = only_parent[p];
+    if (!alias[p] || q == none || adj[p].empty())
+      continue;
+    for (uint32_t c : adj[p]) {
+      if (only_parent[c] == p)
+        only_parent[c] = q;
+    }
+    adj[q].insert(adj[q].end(), adj[p].begin(), adj[p].end());
+    adj[p].clear();
+    bypassed[p] = 1;
+    stats.bypassed++;
+  }
+  if (stats.bypassed != 0) {
+    stats.duplicate += dedupe_edges(adj);
+  }
+
+  // 2. transitive reduction: u -> v is implied when another child w of u
+  // reaches v. Only children with a higher post-order number can, so
+  // children are visited in that order against the union of the labels
+  // seen so far.
+  IntervalSet covered;
+  std::vector<uint32_t> sorted;
+  for (uint32_t u = 0; u < n; ++u) {
+    auto &children = adj[u];
+    if (children.size() < 2)
+      continue;
+
+    sorted.assign(children.begin(), children.end());
+    std::sort(sorted.begin(), sorted.end(), [&reach](uint32_t a, uint32_t b) {
+      return reach.post(a) > reach.post(b);
+    });
+
+    covered.clear();
+    std::vector<uint32_t> redundant;
+    for (uint32_t v : sorted) {
+      if (covered.contains(reach.post(v))) {
+        redundant.push_back(v);
+        continue;
+      }
+      if (bypassed[v] || !reach.is_indexed(v))
+        continue;
+      const auto label = reach.label(v);
+      for (size_t k = 0; k < label.size(); k += 2) {
+        covered.insert(label[k], label[k + 1]);
+      }
+    }
+    if (redundant.empty())
+      continue;
+
+    std::sort(redundant.begin(), redundant.end());
+    stats.transitive += redundant.size();
+    std::erase_if(children, [&redundant](uint32_t v) {
+      return std::binary_search(redundant.begin(), redundant.end(), v);
+    });
+  }
+}
+
+} // namespace exec
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <reach_index.hpp>
+#include <vector>
+
+namespace exec {
+
+// What the --optimize-graph pass did to the scheduling edges (child
+// lists).
+struct OptimizeStats {
+  size_t duplicate = 0;  // edges listed twice (or made so by a bypass)
+  size_t transitive = 0; // edges already implied by another path
+  size_t bypassed = 0;   // phony aliases taken out of the schedule
+
+  inline size_t removed() const noexcept { return duplicate + transitive; }
+};
+
+// Drops repeated entries, keeping the first occurrence (so $< and the
+// order of $^ don't change). Returns the number removed.
+size_t dedupe_edges(std::vector<std::vector<uint32_t>> &lists);
+
+// Scheduling edges only; prerequisite lists stay complete for the mtime
+// checks. `alias[u]` marks phony nodes without a recipe. A node that has
+// a single scheduling prerequisite and is an alias hands its dependents to
+// that prerequisite (chains of aliases collapse onto the first real
+// node), then transitive edges are dropped using `reach`, which must have
+// been built from `adj` before this call.
+void optimize_schedule(std::vector<std::vector<uint32_t>> &adj,
+                       const std::vector<uint8_t> &alias,
+                       const ReachIndex &reach, OptimizeStats &stats);
+
+} // namespace exec
@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <history.hpp>
+#include <iostream>
+#include <serde_utils.hpp>
+#include <utils.hpp>
+#include <vector>
+
+namespace exec {
+
+// On disk: version, run counter, target names, then one vector<vector>
+// per Sample field (column-wise, same order as the names).
+
+BuildHistory BuildHistory::load() {
+  namespace fs = std::filesystem;
+
+  BuildHistory history;
+  history.m_run = 1;
+
+  std::error_code ec;
+  const auto filesize = fs::file_size(BuildHistory::history_file, ec);
+  if (ec || filesize < sizeof(uint32_t)) {
+    return history;
+  }
+
+  std::ifstream in(BuildHistory::history_file, std::ios::binary);
+  std::vector<std::byte> buffer(filesize);
+  in.read(reinterpret_cast<char *>(buffer.data()),
+          static_cast<std::streamsize>(buffer.size()));
+  if (!in) {
+    return history;
+  }
+
+  serde::Reader reader(buffer);
+  if (reader.read<uint32_t>() != HISTORY_SERDE_VERSION) {
+    std::cerr << "build history version mismatch, starting fresh\n";
+    return history;
+  }
+
+  using Column = std::vector<std::vector<uint64_t>>;
+  const auto last_run = reader.read<uint64_t>();
+  auto names = reader.read<std::vector<std::string>>();
+  Column cols[7];
+  for (auto &col : cols) {
+    col = reader.read<Column>();
+  }
+
+  const size_t n = names.size();
+  bool ok = reader.at_end();
+  for (size_t c = 0; ok && c < std::size(cols); ++c) {
+    ok = cols[c].size() == n;
+    for (size_t i = 0; ok && i < n; ++i) {
+      ok = cols[c][i].size() == cols[0][i].size();
+    }
+  }
+  if (!ok) {
+    std::cerr << "build history corrupted, starting fresh\n";
+    return history;
+  }
+
+  history.m_run = last_run + 1;
+  history.m_records.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    std::vector<Sample> samples(cols[0][i].size());
+    for (size_t k = 0; k < samples.size(); ++k) {
+      samples[k] = Sample{cols[0][i][k], cols[1][i][k], cols[2][i][k],
+                          cols[3][i][k], cols[4][i][k], cols[5][i][k],
+                          cols[6][i][k]};
+    }
+    history.m_records.emplace(std::move(names[i]), std::move(samples));
+  }
+  return history;
+}
+
+void BuildHistory::save() const {
+  using Column = std::vector<std::vector<uint64_t>>;
+  std::vector<std::string> names;
+  names.reserve(m_records.size());
+  Column cols[7];
+  for (auto &col : cols) {
+    col.reserve(m_records.size());
+  }
+
+  for (const auto &[name, samples] : m_records) {
+    names.push_back(name);
+    for (auto &col : cols) {
+      col.emplace_back().reserve(samples.size());
+    }
+    for (const auto &s : samples) {
+      cols[0].back().push_back(s.run);
+      cols[1].back().push_back(s.wall_us);
+      cols[2].back().push_back(s.user_us);
+      cols[3].back().push_back(s.sys_us);
+      cols[4].back().push_back(s.max_rss_kb);
+      cols[5].back().push_back(s.inblock);
+      cols[6].back().push_back(s.oublock);
+    }
+  }
+
+  const auto bytestream =
+      serde::serialize_all(HISTORY_SERDE_VERSION, m_run, names, cols[0],
+                           cols[1], cols[2], cols[3], cols[4], cols[5], cols[6]);
+
+  std::ofstream out(BuildHistory::history_file,
+                    std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char *>(bytestream.data()),
+            static_cast<std::streamsize>(bytestream.size()));
+  if (!out) {
+    std::cerr << "failed to write build history\n";
+  }
+}
+
+void BuildHistory::record(const std::string &name, const ResultMsg &res) {
+  if (res.exit_code != 0) {
+    return;
+  }
+  auto &samples = m_records[name];
+  if (samples.size() == history_depth) {
+    samples.erase(samples.begin());
+  }
+  samples.push_back(Sample{m_run, res.wall_us, res.user_us, res.sys_us,
+                           res.max_rss_kb, res.inblock, res.oublock});
+}
+
+uint64_t BuildHistory::expected_rss_kb(const std::string &name) const noexcept {
+  auto it = m_records.find(name);
+  return it == m_records.end() ? 0 : it->second.back().max_rss_kb;
+}
+
+uint64_t BuildHistory::expected_wall_us(const std::string &name) const noexcept {
+  auto it = m_records.find(name);
+  if (it == m_records.end()) {
+    return 0;
+  }
+  // recent samples weigh more than old ones
+  uint64_t estimate = it->second.front().wall_us;
+  for (const auto &s : it->second) {
+    estimate = (estimate + s.wall_us) / 2;
+  }
+  return estimate;
+}
+
+namespace {
+
+uint64_t mean_wall(const std::vector<BuildHistory::Sample> &samples,
+                   size_t first, size_t last) {
+  uint64_t sum = 0;
+  for (size_t i = first; i < last; ++i) {
+    sum += samples[i].wall_us;
+  }
+  return last > first ? sum / (last - first) : 0;
+}
+
+} // namespace
+
+void BuildHistory::report(std::ostream &out) const {
+  if (m_records.empty()) {
+    out << "no build history recorded yet\n";
+    return;
+  }
+
+  struct Row {
+    const std::string *name;
+    const std::vector<Sample> *samples;
+    uint64_t mean;
+  };
+  std::vector<Row> rows;
+  rows.reserve(m_records.size());
+  std::vector<uint64_t> latest_wall;
+  latest_wall.reserve(m_records.size());
+  uint64_t total_cpu = 0;
+
+  for (const auto &[name, samples] : m_records) {
+    rows.push_back(Row{&name, &samples, mean_wall(samples, 0, samples.size())});
+    latest_wall.push_back(samples.back().wall_us);
+    total_cpu += samples.back().user_us + samples.back().sys_us;
+  }
+
+  std::sort(latest_wall.begin(), latest_wall.end());
+  auto pct = [&](double p) {
+    const auto idx = static_cast<size_t>(
+        p * static_cast<double>(latest_wall.size() - 1) + 0.5);
+    return latest_wall[idx];
+  };
+
+  out << std::format("{} targets over {} runs\n", rows.size(), m_run - 1);
+  out << std::format("job wall time (latest): p50 {}  p90 {}  p99 {}  max {}\n",
+                     fmt_us(pct(0.5)), fmt_us(pct(0.9)), fmt_us(pct(0.99)),
+                     fmt_us(latest_wall.back()));
+  out << std::format("total cpu (latest): {}\n\n", fmt_us(total_cpu));
+
+  const size_t top = std::min<size_t>(rows.size(), 15);
+  std::partial_sort(rows.begin(), rows.begin() + static_cast<long>(top),
+                    rows.end(),
+                    [](const Row &a, const Row &b) { return a.mean > b.mean; });
+
+  out << std::format("{:>10} {:>10} {:>10} {:>10} {:>8}  {}\n", "mean wall",
+                     "cpu", "max rss", "io ops", "trend", "target");
+  for (size_t i = 0; i < top; ++i) {
+    const auto &samples = *rows[i].samples;
+    const auto &last = samples.back();
+
+    // trend: the last 3 samples against everything before them
+    std::string trend = "-";
+    if (samples.size() > 3) {
+      const size_t split = samples.size() - 3;
+      const auto before = mean_wall(samples, 0, split);
+      const auto recent = mean_wall(samples, split, samples.size());
+      if (before > 0) {
+        trend = std::format("{:+.0f}%", (static_cast<double>(recent) /
+                                             static_cast<double>(before) -
+                                         1.0) *
+                                            100.0);
+      }
+    }
+
+    out << std::format("{:>10} {:>10} {:>8}MB {:>10} {:>8}  {}\n",
+                       fmt_us(rows[i].mean),
+                       fmt_us(last.user_us + last.sys_us),
+                       last.max_rss_kb / 1024, last.inblock + last.oublock,
+                       trend, *rows[i].name);
+  }
+}
+
+} // namespace exec
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <process_pool.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace exec {
+
+// Per-target measurements kept across runs, keyed by target name so they
+// survive graph rebuilds. Each target keeps its last `history_depth`
+// samples, stamped with the run they were taken in.
+class BuildHistory {
+public:
+  static constexpr std::string history_file = ".build_history";
+  static constexpr uint32_t HISTORY_SERDE_VERSION = 2;
+  static constexpr size_t history_depth = 16;
+
+  struct Sample {
+    uint64_t run;
+    uint64_t wall_us;
+    uint64_t user_us;
+    uint64_t sys_us;
+    uint64_t max_rss_kb;
+    uint64_t inblock;
+    uint64_t oublock;
+  };
+
+  // Missing or outdated history is not an error, just an empty one.
+  // Loading starts a new run.
+  static BuildHistory load();
+  void save() const;
+
+  // Failed results are dropped: they include jobs of a batch that never
+  // ran (zero time and usage), and a failure says little about the cost
+  // of the next successful run.
+  void record(const std::string &name, const ResultMsg &res);
+
+  inline bool empty() const noexcept { return m_records.empty(); }
+  inline bool measured(const std::string &name) const noexcept {
+    return m_records.contains(name);
+  }
+
+  // 0 when the target has never been measured
+  uint64_t expected_rss_kb(const std::string &name) const noexcept;
+  uint64_t expected_wall_us(const std::string &name) const noexcept;
+
+  // `buildir --history`: percentiles, slowest targets and trends
+  void report(std::ostream &out) const;
+
+private:
+  std::unordered_map<std::string, std::vector<Sample>> m_records;
+  uint64_t m_run = 0;
+};
+
+} // namespace exec
@@ -1,21 +1,99 @@
+#include <algorithm>
 #include <exec.hpp>
 #include <file_reader.hpp>
 #include <filesystem>
+#include <fingerprint.hpp>
 #include <optional>
 #include <parse.hpp>
+#include <process_pool.hpp>
+#include <simulate.hpp>
+#include <stats.hpp>
+#include <stream.hpp>
 #include <thread>
+#include <unistd.h>
+
+namespace {
+
+int run_query(const exec::Graph &g, std::string_view kind,
+              std::span<const std::string_view> paths) {
+  std::vector<exec::NodeId> ids;
+  for (const auto path : paths) {
+    std::string name(path);
+    exec::NodeId id = g.get_id(name);
+    if (id == exec::Graph::npos) {
+      id = g.get_id(std::filesystem::path(name).lexically_normal().string());
+    }
+    if (id == exec::Graph::npos) {
+      std::cerr << "buildir: " << name << ": not in the build graph\n";
+      continue;
+    }
+    ids.push_back(id);
+  }
+
+  std::vector<exec::NodeId> out;
+  if (kind == "deps") {
+    out = g.dependencies(ids);
+  } else {
+    out = g.dependents(ids);
+    if (kind == "affected") {
+      // what a build would run: the changed targets themselves (once, and
+      // not again if one of them depends on another) and every dependent
+      // with a recipe (or phony, e.g. test aliases)
+      std::vector<uint8_t> listed(g.size(), 0);
+      for (const auto id : out) {
+        listed[id] = 1;
+      }
+      std::vector<exec::NodeId> changed;
+      for (const auto id : ids) {
+        if (!listed[id]) {
+          listed[id] = 1;
+          changed.push_back(id);
+        }
+      }
+      out.insert(out.begin(), changed.begin(), changed.end());
+      std::erase_if(out, [&g](exec::NodeId id) {
+        return !g.has_recipe(id) && !g.is_phony(id);
+      });
+    }
+  }
+
+  for (const auto id : out) {
+    std::cout << *g.get_name_ref(id) << '\n';
+  }
+  return 0;
+}
+
+} // namespace
 
 int main(int argc, char *argv[]) {
   const char *filename = "Makefile";
   ArgsResult res = ArgsResult::parse_and_filter(argc, argv);
-  std::string task = res.forwarded_args.size()
+  if (res.stats) {
+    stats::enable();
+  }
+
+  if (res.history) {
+    exec::BuildHistory::load().report(std::cout);
+    return 0;
+  }
+
+  // buildir --simulate [target]
+  const bool simulate = res.simulate;
+  // buildir --query=rdeps|deps|affected <paths...>
+  const bool query = res.query.has_value();
+  if (query && *res.query != "rdeps" && *res.query != "deps" &&
+      *res.query != "affected") {
+    fatal("usage: buildir --query=rdeps|deps|affected <paths...>");
+  }
+  std::string task = !res.forwarded_args.empty()
                          ? std::string(res.forwarded_args[0])
                          : exec::default_cmd;
   uint32_t njobs;
   if (res.thread_count.has_value() == false) {
     njobs = exec::default_procs;
-  } else if (*res.thread_count == 0) {
-    njobs = std::thread::hardware_concurrency();
+  } else if (*res.thread_count <= 0) {
+    // hardware_concurrency() is 0 when it can't tell
+    njobs = std::max(1u, std::thread::hardware_concurrency());
   } else {
     njobs = static_cast<uint32_t>(*res.thread_count);
   }
@@ -24,33 +102,161 @@ int main(int argc, char *argv[]) {
     fatal("Makefile not found");
   }
 
-  auto [g, ser_needed] = [&filename]() -> std::pair<exec::Graph, bool> {
-    if (is_newer(exec::Graph::serialize_file, filename)) {
+  // nothing changed since the last successful build of this goal: done,
+  // without loading the graph or starting a worker
+  exec::Fingerprints fingerprints;
+  bool clean = false;
+  if (!simulate && !query) {
+    stats::Scope phase(stats::Phase::Fingerprint);
+    fingerprints = exec::Fingerprints::load();
+    clean = fingerprints.is_clean(task);
+  }
+  if (clean) {
+    if (res.stats) {
+      stats::report(std::cerr, res.stats_json);
+    }
+    return 0;
+  }
+
+  exec::WorkerOptions worker_options;
+  if (res.pin) {
+    auto placement = exec::parse_placement(*res.pin);
+    if (!placement) {
+      fatal("invalid --pin (expected spread, pack, numa-spread or numa-pack)");
+    }
+    worker_options.placement = *placement;
+  }
+  worker_options.nice = res.nice;
+  worker_options.sched_batch = res.sched_batch;
+  if (res.ionice) {
+    auto ionice = parse_ionice(*res.ionice);
+    if (!ionice) {
+      fatal("invalid --ionice (expected idle, best-effort[:0-7] or "
+            "realtime[:0-7])");
+    }
+    worker_options.ionice_class = ionice->first;
+    worker_options.ionice_level = ionice->second;
+  }
+
+  auto history = exec::BuildHistory::load();
+  exec::ProcessPool pool(njobs, worker_options);
+
+  // --stream: jobs start while the Makefile is still being parsed (only
+  // when the graph has to be rebuilt anyway)
+  std::optional<exec::StreamBuild> stream;
+  if (res.stream && !simulate && !query &&
+      !(is_newer(exec::Graph::serialize_file, filename) &&
+        exec::Graph::cache_current())) {
+    stream.emplace(pool, history, task);
+  }
+
+  auto [g, ser_needed] = [&filename, query, &stream,
+                          &res]() -> std::pair<exec::Graph, bool> {
+    if (is_newer(exec::Graph::serialize_file, filename) &&
+        exec::Graph::cache_current()) {
+      stats::Scope phase(stats::Phase::GraphDeserialize);
       return {exec::Graph::deserialize(), false};
     } else {
-      FileReader reader(filename);
-      const auto lines = reader.read_lines();
+      parse::Result parsed_data;
+      if (stream) {
+        stats::Scope phase(stats::Phase::Parse);
+        parsed_data = stream->run(filename);
+      } else {
+        FileReader reader(filename);
+        const auto lines = [&reader] {
+          stats::Scope phase(stats::Phase::ReadLines);
+          return reader.read_lines();
+        }();
 
-      parse::MakefileParser parser;
-      auto parsed_data = parser.parse(lines);
-      for (const auto &pd : parsed_data.phony) {
-        std::cout << "phony: " << pd << '\n';
+        parse::MakefileParser parser;
+        stats::Scope phase(stats::Phase::Parse);
+        parsed_data = parser.parse(lines);
+      }
+      if (!query) {
+        for (const auto &pd : parsed_data.phony) {
+          std::cout << "phony: " << pd << '\n';
+        }
       }
 
-      return {exec::Graph::build(parsed_data), true};
+      stats::Scope phase(stats::Phase::GraphBuild);
+      if (!res.optimize_graph) {
+        return {exec::Graph::build(parsed_data), true};
+      }
+      exec::OptimizeStats removed;
+      auto graph = exec::Graph::build(parsed_data, &removed);
+      std::cerr << "optimize-graph: removed " << removed.removed()
+                << " edges (" << removed.duplicate << " duplicate, "
+                << removed.transitive << " transitive), bypassed "
+                << removed.bypassed << " phony aliases\n";
+      return {std::move(graph), true};
     }
   }();
 
-  exec::Scheduler s(njobs);
-  s.start_pool();
+  if (query) {
+    if (*res.query != "deps" && !g.has_reach_index()) {
+      g.build_reach_index();
+      ser_needed = true;
+    }
+    if (ser_needed) {
+      g.serialize();
+    }
+    return run_query(g, *res.query, res.forwarded_args);
+  }
+
+  exec::MemoryLimits limits;
+  limits.mem_budget_kb = res.mem_budget_kb.value_or(0);
+  limits.mem_psi_avg10 = res.mem_psi_avg10.value_or(0);
+
+  std::vector<exec::NodeId> prebuilt;
+  if (stream) {
+    stream->finish();
+    prebuilt = stream->prebuilt(g);
+  }
+
+  if (simulate) {
+    exec::SimExecutor sim(njobs,
+                          exec::SimExecutor::durations_from(g, history));
+    exec::Scheduler s(sim, history, limits, exec::RunMode::Simulate);
+
+    const auto started = std::chrono::steady_clock::now();
+    s.run(g, task);
+    exec::report_simulation(g, s.overlay(), sim,
+                            std::chrono::steady_clock::now() - started,
+                            std::cout);
+    return 0;
+  }
+
+  std::optional<exec::Progress> progress;
+  if (res.progress) {
+    progress.emplace(std::cerr, isatty(STDERR_FILENO) != 0);
+  }
+  exec::Scheduler s(pool, history, limits, exec::RunMode::Build,
+                    progress ? &*progress : nullptr);
 
   std::optional<std::jthread> bg_serialize;
 
   if (ser_needed) {
-    auto work = [](const exec::Graph &graph) { graph.serialize(); };
+    auto work = [](const exec::Graph &graph) {
+      stats::Scope phase(stats::Phase::GraphSerialize);
+      graph.serialize();
+    };
+    pool.start(); // workers can't be forked safely once it runs
     bg_serialize.emplace(work, std::ref(g));
   }
-  s.run(g, task);
+  s.run(g, task, prebuilt);
+  history.save();
+  {
+    stats::Scope phase(stats::Phase::Fingerprint);
+    fingerprints.record(g, g.get_id(task), filename, s.overlay());
+    fingerprints.save();
+  }
+
+  if (res.stats) {
+    if (bg_serialize) {
+      bg_serialize->join();
+    }
+    stats::report(std::cerr, res.stats_json);
+  }
 
   return 0;
 }
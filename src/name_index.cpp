@@ -0,0 +1,51 @@
+#include <algorithm>
+#include <name_index.hpp>
+#include <parallel.hpp>
+
+namespace exec {
+
+NameIndex::NodeId NameIndex::assign(const std::vector<std::string> &names,
+                                    size_t threads) {
+  const size_t n = names.size();
+
+  std::vector<uint8_t> shard(n);
+  parallel_chunks(n, threads, [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      shard[i] = static_cast<uint8_t>(shard_of(names[i]));
+    }
+  });
+
+  // ids per shard, ascending
+  std::array<std::vector<NodeId>, shard_count> members;
+  {
+    std::array<size_t, shard_count> counts{};
+    for (uint8_t s : shard) {
+      counts[s]++;
+    }
+    for (size_t s = 0; s < shard_count; ++s) {
+      members[s].reserve(counts[s]);
+    }
+    for (NodeId i = 0; i < n; ++i) {
+      members[shard[i]].push_back(i);
+    }
+  }
+
+  std::array<NodeId, shard_count> first_dup;
+  first_dup.fill(npos);
+  parallel_chunks(shard_count, std::min(threads, shard_count),
+                  [&](size_t first, size_t last) {
+                    for (size_t s = first; s < last; ++s) {
+                      auto &map = m_shards[s];
+                      map.reserve(members[s].size());
+                      for (NodeId i : members[s]) {
+                        if (!map.emplace(names[i], i).second) {
+                          first_dup[s] = i;
+                          break;
+                        }
+                      }
+                    }
+                  });
+  return *std::min_element(first_dup.begin(), first_dup.end());
+}
+
+} // namespace exec
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace exec {
+
+// Target name => NodeId, split into shards by name hash so that shards
+// can be filled (and looked up) from several threads at once. The shard
+// count is fixed, the result doesn't depend on the number of threads.
+class NameIndex {
+public:
+  using NodeId = uint32_t;
+  static constexpr NodeId npos = std::numeric_limits<NodeId>::max();
+  static constexpr size_t shard_count = 64;
+
+  // names[i] => i, into an empty index. Returns the first i whose name
+  // repeats an earlier one (the rest of its shard is skipped), or npos.
+  NodeId assign(const std::vector<std::string> &names, size_t threads);
+
+  // false if the name is already present
+  inline bool emplace(const std::string &name, NodeId id) {
+    return m_shards[shard_of(name)].emplace(name, id).second;
+  }
+
+  inline NodeId find(const std::string &name) const noexcept {
+    const auto &shard = m_shards[shard_of(name)];
+    auto it = shard.find(name);
+    return it == shard.end() ? npos : it->second;
+  }
+
+private:
+  static inline size_t shard_of(const std::string &name) noexcept {
+    return std::hash<std::string>{}(name) % shard_count;
+  }
+
+  std::array<std::unordered_map<std::string, NodeId>, shard_count> m_shards;
+};
+
+} // namespace exec
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace exec {
+
+// Threads for `n` items of cheap work: 1 below min_per_thread items per
+// thread, never more than the hardware has.
+inline size_t worker_threads(size_t n, size_t min_per_thread) {
+  const size_t hw = std::max(1u, std::thread::hardware_concurrency());
+  return std::max<size_t>(1, std::min(hw, n / min_per_thread));
+}
+
+// fn(first, last) over [0, n) in `threads` contiguous chunks; on the
+// calling thread when threads <= 1.
+template <typename Fn> void parallel_chunks(size_t n, size_t threads, Fn &&fn) {
+  if (threads <= 1 || n == 0) {
+    fn(size_t{0}, n);
+    return;
+  }
+  std::vector<std::jthread> workers;
+  const size_t per = (n + threads - 1) / threads;
+  for (size_t first = 0; first < n; first += per) {
+    workers.emplace_back(fn, first, std::min(n, first + per));
+  }
+}
+
+} // namespace exec
@@ -1,70 +1,185 @@
+#include <charconv>
 #include <cstdlib>
 #include <iostream>
 #include <parse.hpp>
 #include <ranges>
 #include <string_view>
+#include <utility>
 #include <utils.hpp>
 
 namespace parse {
 
 ::parse::Result
 MakefileParser::parse(const std::vector<std::string> &lines) const {
-  Result result;
+  StreamParser parser;
+  for (const std::string &line : lines) {
+    parser.feed(line);
+    if (parser.error()) {
+      fatal(parser.error()->c_str());
+    }
+  }
+  parser.finish();
+  if (parser.error()) {
+    fatal(parser.error()->c_str());
+  }
+  return parser.take();
+}
 
-  Rule current;
-  bool in_rule = false;
+void StreamParser::fail(const char *msg) {
+  if (!m_error) {
+    m_error = msg;
+  }
+}
 
-  for (const std::string &line : lines) {
+void StreamParser::feed(const std::string &line) {
+  if (m_error) {
+    return;
+  }
 
-    // .PHONY
-    if (line.starts_with(".PHONY:")) {
-      std::string_view rest(line.c_str() + 7);
-      for (auto part : rest | std::views::split(' ')) {
-        if (!part.empty())
-          result.phony.emplace_back(part.begin(), part.end());
-      }
-      continue;
+  // .PHONY
+  if (line.starts_with(".PHONY:")) {
+    std::string_view rest(line.c_str() + 7);
+    for (auto part : rest | std::views::split(' ')) {
+      if (!part.empty())
+        m_result.phony.emplace_back(part.begin(), part.end());
+    }
+    return;
+  }
+
+  // .POOL: <name> <depth>
+  if (line.starts_with(".POOL:")) {
+    std::string_view rest(line.c_str() + 6);
+    std::vector<std::string_view> parts;
+    for (auto part : rest | std::views::split(' ')) {
+      if (!part.empty())
+        parts.emplace_back(part.begin(), part.end());
+    }
+    if (parts.size() != 2) {
+      return fail("invalid .POOL (expected: .POOL: <name> <depth>)");
     }
 
-    // command
-    if (!line.empty() && line[0] == '\t') {
-      if (!in_rule) {
-        fatal("command without target");
-      }
+    uint32_t depth = 0;
+    auto [ptr, ec] = std::from_chars(
+        parts[1].data(), parts[1].data() + parts[1].size(), depth);
+    if (ec != std::errc{} || ptr != parts[1].data() + parts[1].size() ||
+        depth == 0) {
+      return fail("invalid .POOL depth");
+    }
 
-      if (line.size() > 1)
-        current.commands.emplace_back(line.begin() + 1, line.end());
+    m_result.pools.push_back(Pool{std::string(parts[0]), depth});
+    return;
+  }
 
-      continue;
+  // .USE_POOL: <name> <targets...>
+  if (line.starts_with(".USE_POOL:")) {
+    std::string_view rest(line.c_str() + 10);
+    std::string pool;
+    for (auto part : rest | std::views::split(' ')) {
+      if (part.empty())
+        continue;
+      if (pool.empty())
+        pool.assign(part.begin(), part.end());
+      else
+        m_result.pool_members.emplace_back(
+            pool, std::string(part.begin(), part.end()));
     }
+    if (pool.empty()) {
+      return fail(
+          "invalid .USE_POOL (expected: .USE_POOL: <name> <targets...>)");
+    }
+    return;
+  }
 
-    // new rule
-    if (in_rule) {
-      result.rules.push_back(std::move(current));
-      current = {};
+  // .DYNDEP: <targets...>
+  if (line.starts_with(".DYNDEP:")) {
+    std::string_view rest(line.c_str() + 8);
+    for (auto part : rest | std::views::split(' ')) {
+      if (!part.empty())
+        m_result.dyndeps.emplace_back(part.begin(), part.end());
     }
+    return;
+  }
 
-    auto colon = line.find(':');
-    if (colon == std::string::npos) {
-      std::cout << "line: " << line << '\n';
-      fatal("invalid rule (missing ':')");
+  // command
+  if (!line.empty() && line[0] == '\t') {
+    if (!m_in_rule) {
+      return fail("command without target");
     }
-    current.name.assign(line.begin(), line.begin() + static_cast<long>(colon));
 
-    std::string_view deps(line.begin() + static_cast<long>(colon + 1),
-                          line.end());
-    for (auto dep : deps | std::views::split(' ')) {
-      if (!dep.empty())
-        current.deps.emplace_back(dep.begin(), dep.end());
+    if (line.size() > 1)
+      m_current.commands.emplace_back(line.begin() + 1, line.end());
+
+    return;
+  }
+
+  // new rule
+  if (m_in_rule) {
+    flush();
+  }
+
+  auto colon = line.find(':');
+  if (colon == std::string::npos) {
+    std::cout << "line: " << line << '\n';
+    return fail("invalid rule (missing ':')");
+  }
+  if (colon > 0 && line[colon - 1] == '&') {
+    // grouped targets: one recipe writes all of them
+    std::string_view names(line.data(), colon - 1);
+    for (auto part : names | std::views::split(' ')) {
+      if (part.empty())
+        continue;
+      if (m_current.name.empty())
+        m_current.name.assign(part.begin(), part.end());
+      else
+        m_current.grouped.emplace_back(part.begin(), part.end());
     }
+    if (m_current.name.empty()) {
+      return fail("grouped rule without targets");
+    }
+  } else {
+    m_current.name.assign(line.begin(),
+                          line.begin() + static_cast<long>(colon));
+  }
 
-    in_rule = true;
+  std::string_view deps(line.begin() + static_cast<long>(colon + 1),
+                        line.end());
+  std::string_view order_only;
+  if (auto bar = deps.find('|'); bar != std::string_view::npos) {
+    order_only = deps.substr(bar + 1);
+    deps = deps.substr(0, bar);
   }
+  for (auto dep : deps | std::views::split(' ')) {
+    if (!dep.empty())
+      m_current.deps.emplace_back(dep.begin(), dep.end());
+  }
+  for (auto dep : order_only | std::views::split(' ')) {
+    if (!dep.empty())
+      m_current.order_only.emplace_back(dep.begin(), dep.end());
+  }
+
+  m_in_rule = true;
+}
 
-  if (in_rule)
-    result.rules.push_back(std::move(current));
+void StreamParser::flush() {
+  if (m_current.name.find('%') != std::string::npos) {
+    if (!m_current.grouped.empty()) {
+      m_current = {};
+      m_in_rule = false;
+      return fail("grouped pattern rules are not supported");
+    }
+    m_result.pattern_rules.push_back(std::move(m_current));
+  } else {
+    m_result.rules.push_back(std::move(m_current));
+  }
+  m_current = {};
+  m_in_rule = false;
+}
 
-  return result;
+void StreamParser::finish() {
+  if (m_in_rule && !m_error)
+    flush();
 }
 
+::parse::Result StreamParser::take() { return std::exchange(m_result, {}); }
+
 } // namespace parse
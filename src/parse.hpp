@@ -1,18 +1,37 @@
 #pragma once
 
+#include <cstdint>
+#include <optional>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace parse {
+struct Pool {
+  std::string name;
+  uint32_t depth;
+};
+
 struct Rule {
   std::string name;
+  // further targets of a grouped rule (`a.c a.h &: a.y`), name is the first
+  std::vector<std::string> grouped;
   std::vector<std::string> deps;
+  // after '|': ordering only, never compared by mtime
+  std::vector<std::string> order_only;
   std::vector<std::string> commands;
 };
 
 struct Result {
   std::vector<std::string> phony;
   std::vector<::parse::Rule> rules;
+  // rules whose name contains '%', e.g. "%.o: %.c"
+  std::vector<::parse::Rule> pattern_rules;
+  std::vector<::parse::Pool> pools;
+  // (pool name, target name)
+  std::vector<std::pair<std::string, std::string>> pool_members;
+  // targets that write a dyndep file (.DYNDEP)
+  std::vector<std::string> dyndeps;
 };
 
 class MakefileParser {
@@ -20,4 +39,28 @@ public:
   ::parse::Result parse(const std::vector<std::string> &lines) const;
 };
 
+// Incremental form of MakefileParser. Lines are fed one at a time and
+// take() hands out everything completed since the previous call; a rule is
+// complete once the next rule starts (or at finish()).
+class StreamParser {
+public:
+  void feed(const std::string &line);
+  void finish();
+  ::parse::Result take();
+
+  // the first syntax error; later lines are ignored
+  inline const std::optional<std::string> &error() const noexcept {
+    return m_error;
+  }
+
+private:
+  void flush();
+  void fail(const char *msg);
+
+  ::parse::Result m_result;
+  std::optional<std::string> m_error;
+  ::parse::Rule m_current;
+  bool m_in_rule = false;
+};
+
 } // namespace parse
@@ -1,52 +1,207 @@
 #include "process_pool.hpp"
 
 #include <algorithm>
+#include <builtin.hpp>
 #include <cerrno>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <sched.h>
+#include <span>
 #include <signal.h>
+#include <sys/resource.h>
 #include <sys/select.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <stats.hpp>
+#include <utils.hpp>
 
 namespace exec {
 
 // IPC messages
+//
+// A task travels as one TaskHeader followed by `payload_size` bytes holding
+// `cmd_count` commands, each as a uint32_t length and the raw bytes. The
+// whole frame goes out in a single writev and is read back with two reads.
+// The worker answers a task with one ResultMsg.
+//
+// A Batch carries `cmd_count` jobs instead, each as a BatchJobHeader and its
+// commands. The worker runs them in order, stops after the first failure and
+// answers with a uint32_t result count followed by that many ResultMsgs.
+
+enum class MsgKind : uint32_t {
+  Task = 1,
+  Shutdown = 2,
+  BuiltinTask = 3,
+  Batch = 4
+};
 
-struct TaskMsg {
+struct TaskHeader {
+  MsgKind kind;
   NodeId node_id;
-  uint32_t cmd_count; // 0 => shutdown
+  uint32_t cmd_count;
+  uint32_t payload_size;
 };
 
-// Worker process code
+struct BatchJobHeader {
+  NodeId node_id;
+  uint32_t builtin;
+  uint32_t cmd_count;
+};
 
-void ProcessPool::worker_loop(int read_fd, int write_fd) {
-  while (true) {
-    TaskMsg msg;
-    ssize_t r = read(read_fd, &msg, sizeof(msg));
+// IO helpers (retry on EINTR and short transfers)
+
+static bool read_exact(int fd, void *buf, size_t len) {
+  auto *p = static_cast<char *>(buf);
+  while (len > 0) {
+    ssize_t r = read(fd, p, len);
+    if (r < 0 && errno == EINTR)
+      continue;
     if (r <= 0)
+      return false;
+    p += r;
+    len -= static_cast<size_t>(r);
+  }
+  return true;
+}
+
+static bool write_all(int fd, iovec *iov, int iovcnt) {
+  while (iovcnt > 0) {
+    ssize_t w = writev(fd, iov, iovcnt);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w < 0)
+      return false;
+
+    auto done = static_cast<size_t>(w);
+    while (iovcnt > 0 && done >= iov->iov_len) {
+      done -= iov->iov_len;
+      ++iov;
+      --iovcnt;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + done;
+      iov->iov_len -= done;
+    }
+  }
+  return true;
+}
+
+static bool write_all(int fd, const void *buf, size_t len) {
+  iovec iov{const_cast<void *>(buf), len};
+  return write_all(fd, &iov, 1);
+}
+
+// Worker process code
+
+// Runs `cmd` through /bin/sh like std::system, but reaps the child with
+// wait4 so its resource usage is available. Returns the wait status.
+static int run_command(const std::string &cmd, rusage &usage) {
+  pid_t pid = fork();
+  if (pid < 0)
+    return -1;
+
+  if (pid == 0) {
+    execl("/bin/sh", "sh", "-c", cmd.c_str(), static_cast<char *>(nullptr));
+    _exit(127);
+  }
+
+  int status = 0;
+  while (wait4(pid, &status, 0, &usage) < 0) {
+    if (errno != EINTR)
+      return -1;
+  }
+  return status;
+}
+
+static uint64_t to_us(const timeval &tv) {
+  return static_cast<uint64_t>(tv.tv_sec) * 1'000'000 +
+         static_cast<uint64_t>(tv.tv_usec);
+}
+
+// Runs the `cmd_count` commands at `p`, stopping at the first failure.
+// Leaves `p` past the job when it succeeds.
+static ResultMsg run_job(NodeId id, const char *&p, uint32_t cmd_count,
+                         bool builtin_hint) {
+  ResultMsg res{};
+  res.node_id = id;
+  int rc = 0;
+  const auto started = std::chrono::steady_clock::now();
+
+  for (uint32_t i = 0; i < cmd_count; ++i) {
+    uint32_t len;
+    std::memcpy(&len, p, sizeof(len));
+    p += sizeof(len);
+
+    std::string cmd(p, len);
+    p += len;
+
+    rusage usage{};
+    if (auto b = builtin_hint ? builtin::parse(cmd) : std::nullopt) {
+      rc = builtin::run(*b);
+    } else {
+      rc = run_command(cmd, usage);
+    }
+    res.user_us += to_us(usage.ru_utime);
+    res.sys_us += to_us(usage.ru_stime);
+    res.max_rss_kb =
+        std::max(res.max_rss_kb, static_cast<uint64_t>(usage.ru_maxrss));
+    res.inblock += static_cast<uint64_t>(usage.ru_inblock);
+    res.oublock += static_cast<uint64_t>(usage.ru_oublock);
+    if (rc != 0)
       break;
+  }
 
-    if (msg.cmd_count == 0)
-      break; // shutdown
+  res.exit_code = rc;
+  res.wall_us = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - started)
+          .count());
+  return res;
+}
 
-    int rc = 0;
+void ProcessPool::worker_loop(int read_fd, int write_fd) {
+  std::vector<char> payload;
+  std::vector<ResultMsg> results;
 
-    for (uint32_t i = 0; i < msg.cmd_count; ++i) {
-      uint32_t len;
-      read(read_fd, &len, sizeof(len));
+  while (true) {
+    TaskHeader hdr;
+    if (!read_exact(read_fd, &hdr, sizeof(hdr)))
+      break;
 
-      std::string cmd(len, '\0');
-      read(read_fd, cmd.data(), len);
+    if (hdr.kind == MsgKind::Shutdown)
+      break;
+
+    payload.resize(hdr.payload_size);
+    if (!read_exact(read_fd, payload.data(), payload.size()))
+      break;
 
-      rc = std::system(cmd.c_str());
-      if (rc != 0)
+    const char *p = payload.data();
+    if (hdr.kind != MsgKind::Batch) {
+      const ResultMsg res = run_job(hdr.node_id, p, hdr.cmd_count,
+                                    hdr.kind == MsgKind::BuiltinTask);
+      if (!write_all(write_fd, &res, sizeof(res)))
         break;
+      continue;
     }
 
-    ResultMsg res{msg.node_id, rc};
-    write(write_fd, &res, sizeof(res));
+    results.clear();
+    for (uint32_t j = 0; j < hdr.cmd_count; ++j) {
+      BatchJobHeader job;
+      std::memcpy(&job, p, sizeof(job));
+      p += sizeof(job);
+      results.push_back(run_job(job.node_id, p, job.cmd_count, job.builtin));
+      if (results.back().exit_code != 0)
+        break;
+    }
+    auto count = static_cast<uint32_t>(results.size());
+    iovec iov[2] = {{&count, sizeof(count)},
+                    {results.data(), results.size() * sizeof(ResultMsg)}};
+    if (!write_all(write_fd, iov, 2))
+      break;
   }
 
   _exit(0);
@@ -54,42 +209,104 @@ void ProcessPool::worker_loop(int read_fd, int write_fd) {
 
 // ProcessPool impl
 
-ProcessPool::ProcessPool(size_t workers) : m_workers(workers) {}
-
-ProcessPool::~ProcessPool() { shutdown(); }
+ProcessPool::ProcessPool(size_t workers, WorkerOptions options)
+    : m_workers(workers), m_options(options) {}
+
+void ProcessPool::apply_worker_options(const WorkerOptions &options,
+                                       const std::vector<int> &cpus) {
+  // best effort: a worker that can't be pinned or deprioritized still works
+  if (!cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+      CPU_SET(static_cast<size_t>(cpu), &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+      std::cerr << "worker: sched_setaffinity failed: " << std::strerror(errno)
+                << '\n';
+  }
 
-void ProcessPool::start() {
-  if (m_running)
-    return;
+  if (options.sched_batch) {
+    sched_param param{};
+    if (sched_setscheduler(0, SCHED_BATCH, &param) != 0)
+      std::cerr << "worker: SCHED_BATCH failed: " << std::strerror(errno)
+                << '\n';
+  }
 
-  for (auto &w : m_workers) {
-    int p2c[2], c2p[2];
-    pipe(p2c);
-    pipe(c2p);
+  if (options.nice) {
+    if (setpriority(PRIO_PROCESS, 0, *options.nice) != 0)
+      std::cerr << "worker: setpriority failed: " << std::strerror(errno)
+                << '\n';
+  }
 
-    pid_t pid = fork();
-    if (pid == 0) {
-      // child
-      close(p2c[1]);
-      close(c2p[0]);
+  if (options.ionice_class) {
+    // linux/ioprio.h: IOPRIO_WHO_PROCESS, class in the top bits
+    constexpr int ioprio_who_process = 1;
+    constexpr int ioprio_class_shift = 13;
+    const int prio =
+        (*options.ionice_class << ioprio_class_shift) | options.ionice_level;
+    if (syscall(SYS_ioprio_set, ioprio_who_process, 0, prio) != 0)
+      std::cerr << "worker: ioprio_set failed: " << std::strerror(errno)
+                << '\n';
+  }
+}
 
-      // reset signals to default
-      signal(SIGINT, SIG_DFL);
-      signal(SIGTERM, SIG_DFL);
+ProcessPool::~ProcessPool() { shutdown(); }
 
-      worker_loop(p2c[0], c2p[1]);
+void ProcessPool::start() {
+  for (size_t i = 0; i < m_workers.size(); ++i) {
+    if (m_workers[i].pid < 0) {
+      spawn(i);
     }
+  }
+}
+
+// The child goes on to allocate and use iostreams, which is only safe if
+// no other thread could hold the malloc or stdio locks at fork time. So
+// lazy forking (claim()) relies on the calling thread being the only one;
+// whoever starts a helper thread that may outlive a submit() (the --stream
+// reader, the background graph serialization) calls start() first.
+void ProcessPool::spawn(size_t i) {
+  stats::Scope phase(stats::Phase::PoolStart);
+  if (m_placement.empty()) {
+    m_placement = plan_placement(m_options.placement, m_workers.size());
+  }
 
-    // parent
-    close(p2c[0]);
-    close(c2p[1]);
+  // a worker that died leaves a broken pipe: writes to it must fail with
+  // EPIPE instead of killing buildir
+  signal(SIGPIPE, SIG_IGN);
 
-    w.pid = pid;
-    w.to_child = p2c[1];
-    w.from_child = c2p[0];
-    w.busy = false;
+  auto &w = m_workers[i];
+  int p2c[2], c2p[2];
+  if (pipe(p2c) != 0 || pipe(c2p) != 0) {
+    fatal("ProcessPool: pipe failed");
   }
 
+  pid_t pid = fork();
+  if (pid < 0) {
+    fatal("ProcessPool: fork failed");
+  }
+  if (pid == 0) {
+    // child
+    close(p2c[1]);
+    close(c2p[0]);
+
+    // reset signals to default
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+
+    apply_worker_options(m_options, m_placement[i]);
+    worker_loop(p2c[0], c2p[1]);
+  }
+
+  // parent
+  close(p2c[0]);
+  close(c2p[1]);
+
+  w.pid = pid;
+  w.to_child = p2c[1];
+  w.from_child = c2p[0];
+  w.busy = false;
   m_running = true;
 }
 
@@ -98,20 +315,21 @@ bool ProcessPool::can_accept() const {
                      [](const Worker &w) { return !w.busy; });
 }
 
-void ProcessPool::submit(NodeId id, const Node &commands) {
-  for (auto &w : m_workers) {
-    if (!w.busy) {
-      TaskMsg msg{id, static_cast<uint32_t>(commands.size())};
-      write(w.to_child, &msg, sizeof(msg));
-
-      for (const auto &cmd : commands) {
-        uint32_t len = cmd.size();
-        write(w.to_child, &len, sizeof(len));
-        write(w.to_child, cmd.data(), len);
-      }
+ProcessPool::Worker &ProcessPool::claim() {
+  // reuse a running worker before forking another one
+  auto it = std::find_if(m_workers.begin(), m_workers.end(),
+                         [](const Worker &w) { return !w.busy && w.pid > 0; });
+  if (it == m_workers.end()) {
+    it = std::find_if(m_workers.begin(), m_workers.end(),
+                      [](const Worker &w) { return w.pid < 0; });
+    if (it != m_workers.end()) {
+      spawn(static_cast<size_t>(it - m_workers.begin()));
+    }
+  }
 
-      w.busy = true;
-      return;
+  for (auto &w : std::span(it, m_workers.end())) {
+    if (!w.busy) {
+      return w;
     }
   }
 
@@ -119,7 +337,91 @@ void ProcessPool::submit(NodeId id, const Node &commands) {
   std::abort();
 }
 
+void ProcessPool::append_commands(const Node &commands) {
+  for (const auto &cmd : commands) {
+    auto len = static_cast<uint32_t>(cmd.size());
+    const auto *lp = reinterpret_cast<const char *>(&len);
+    m_frame.insert(m_frame.end(), lp, lp + sizeof(len));
+    m_frame.insert(m_frame.end(), cmd.begin(), cmd.end());
+  }
+}
+
+void ProcessPool::submit(NodeId id, const Node &commands, bool builtin) {
+  Worker &w = claim();
+  m_frame.clear();
+  append_commands(commands);
+
+  TaskHeader hdr{builtin ? MsgKind::BuiltinTask : MsgKind::Task, id,
+                 static_cast<uint32_t>(commands.size()),
+                 static_cast<uint32_t>(m_frame.size())};
+  iovec iov[2] = {{&hdr, sizeof(hdr)}, {m_frame.data(), m_frame.size()}};
+  if (!write_all(w.to_child, iov, 2)) {
+    fatal("ProcessPool: failed to send task to worker");
+  }
+
+  w.jobs.assign(1, id);
+  w.busy = true;
+  w.batch = false;
+}
+
+void ProcessPool::submit_batch(std::span<const BatchJob> jobs) {
+  if (jobs.empty()) {
+    return;
+  }
+  if (jobs.size() == 1) {
+    submit(jobs[0].id, jobs[0].commands, jobs[0].builtin);
+    return;
+  }
+  if (jobs.size() > max_batch) {
+    fatal("ProcessPool: batch too large");
+  }
+
+  Worker &w = claim();
+  m_frame.clear();
+  for (const auto &job : jobs) {
+    BatchJobHeader jh{job.id, job.builtin ? 1u : 0u,
+                      static_cast<uint32_t>(job.commands.size())};
+    const auto *hp = reinterpret_cast<const char *>(&jh);
+    m_frame.insert(m_frame.end(), hp, hp + sizeof(jh));
+    append_commands(job.commands);
+  }
+
+  TaskHeader hdr{MsgKind::Batch, jobs[0].id,
+                 static_cast<uint32_t>(jobs.size()),
+                 static_cast<uint32_t>(m_frame.size())};
+  iovec iov[2] = {{&hdr, sizeof(hdr)}, {m_frame.data(), m_frame.size()}};
+  if (!write_all(w.to_child, iov, 2)) {
+    fatal("ProcessPool: failed to send batch to worker");
+  }
+
+  w.jobs.clear();
+  for (const auto &job : jobs) {
+    w.jobs.push_back(job.id);
+  }
+  w.busy = true;
+  w.batch = true;
+}
+
 ResultMsg ProcessPool::wait_result() {
+  if (!m_results.empty()) {
+    return pop_result();
+  }
+  return *collect(nullptr);
+}
+
+std::optional<ResultMsg>
+ProcessPool::wait_result_for(std::chrono::milliseconds timeout) {
+  if (!m_results.empty()) {
+    return pop_result();
+  }
+  timeval tv{};
+  tv.tv_sec = static_cast<time_t>(timeout.count() / 1000);
+  tv.tv_usec = static_cast<suseconds_t>(timeout.count() % 1000 * 1000);
+  return collect(&tv);
+}
+
+// timeout == nullptr blocks until a job finishes
+std::optional<ResultMsg> ProcessPool::collect(timeval *timeout) {
   fd_set set;
   FD_ZERO(&set);
 
@@ -131,20 +433,75 @@ ResultMsg ProcessPool::wait_result() {
     }
   }
 
-  select(maxfd + 1, &set, nullptr, nullptr, nullptr);
+  fd_set ready;
+  int n;
+  do {
+    ready = set;
+    n = select(maxfd + 1, &ready, nullptr, nullptr, timeout);
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0) {
+    fatal("ProcessPool: select failed");
+  }
+  if (n == 0) {
+    return std::nullopt;
+  }
 
   for (auto &w : m_workers) {
-    if (w.busy && FD_ISSET(w.from_child, &set)) {
-      ResultMsg res;
-      read(w.from_child, &res, sizeof(res));
+    if (w.busy && FD_ISSET(w.from_child, &ready)) {
       w.busy = false;
-      return res;
+      // only called once m_results is drained, so it holds this reply only
+      uint32_t count = 1;
+      if (w.batch && (!read_exact(w.from_child, &count, sizeof(count)) ||
+                      count == 0 || count > w.jobs.size())) {
+        died(w, 0);
+        return pop_result();
+      }
+      for (uint32_t i = 0; i < count; ++i) {
+        if (!read_exact(w.from_child, &m_results.emplace_back(),
+                        sizeof(ResultMsg))) {
+          m_results.pop_back();
+          died(w, i);
+          return pop_result();
+        }
+      }
+      // the jobs after a failure in the batch never ran
+      fail_rest(w, count);
+      return pop_result();
     }
   }
 
   std::abort();
 }
 
+// every job of `w` past the first `reported` ones is queued as failed
+void ProcessPool::fail_rest(const Worker &w, size_t reported) {
+  for (size_t i = reported; i < w.jobs.size(); ++i) {
+    ResultMsg res{};
+    res.node_id = w.jobs[i];
+    res.exit_code = -1;
+    m_results.push_back(res);
+  }
+}
+
+// worker died mid-task: reap it (claim() forks a new one in its place)
+// and report whatever it didn't report yet as failed
+void ProcessPool::died(Worker &w, size_t reported) {
+  kill(w.pid, SIGKILL);
+  waitpid(w.pid, nullptr, 0);
+  close(w.to_child);
+  close(w.from_child);
+  w.pid = -1;
+  w.busy = false;
+  fail_rest(w, reported);
+}
+
+ResultMsg ProcessPool::pop_result() {
+  ResultMsg res = m_results.front();
+  m_results.pop_front();
+  return res;
+}
+
 void ProcessPool::shutdown() {
   if (!m_running)
     return;
@@ -152,8 +509,8 @@ void ProcessPool::shutdown() {
   // tell workers to exit
   for (auto &w : m_workers) {
     if (w.pid > 0) {
-      TaskMsg msg{0, 0};
-      write(w.to_child, &msg, sizeof(msg));
+      TaskHeader hdr{MsgKind::Shutdown, 0, 0, 0};
+      write_all(w.to_child, &hdr, sizeof(hdr));
     }
   }
 
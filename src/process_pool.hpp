@@ -1,44 +1,81 @@
 #pragma once
 
+#include <chrono>
+#include <cpu_topology.hpp>
 #include <cstdint>
+#include <deque>
+#include <executor.hpp>
+#include <optional>
+#include <span>
 #include <string>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <vector>
 
 namespace exec {
 
-using NodeId = uint32_t;
-using Node = std::vector<std::string>;
-
-struct ResultMsg {
-  NodeId node_id;
-  int32_t exit_code;
+// Applied in each worker before it runs any command; commands inherit it.
+struct WorkerOptions {
+  Placement placement = Placement::None;
+  std::optional<int> nice;
+  std::optional<int> ionice_class; // 1 realtime, 2 best-effort, 3 idle
+  int ionice_level = 4;            // 0 (highest) .. 7
+  bool sched_batch = false;
 };
 
-class ProcessPool {
+class ProcessPool final : public Executor {
 public:
-  explicit ProcessPool(size_t workers);
-  ~ProcessPool();
+  explicit ProcessPool(size_t workers, WorkerOptions options = {});
+  ~ProcessPool() override;
 
+  // Workers are forked on demand by submit(), one at a time and only when
+  // no started worker is idle; start() forks all of them up front. Call
+  // start() before starting any other thread (see spawn()).
   void start();
-  bool can_accept() const;
+  bool can_accept() const override;
+  inline size_t slots() const override { return m_workers.size(); }
+
+  // builtin commands run inside the worker without a shell (falling back
+  // to /bin/sh for lines that turn out not to be builtins)
+  void submit(NodeId id, const Node &commands, bool builtin = false) override;
+  ResultMsg wait_result() override; // blocking
+  // nullopt if no job finished within `timeout`
+  std::optional<ResultMsg> wait_result_for(std::chrono::milliseconds timeout);
 
-  void submit(NodeId id, const Node &commands);
-  ResultMsg wait_result(); // blocking
+  static constexpr size_t max_batch = 32;
+  inline size_t batch_capacity() const override { return max_batch; }
+  // one worker runs the jobs in order and replies once with every result
+  void submit_batch(std::span<const BatchJob> jobs) override;
 
-  void shutdown(); // safe to call multiple times
+  void shutdown() override; // safe to call multiple times
 
 private:
   struct Worker {
     pid_t pid = -1;
     int to_child = -1;
     int from_child = -1;
+    std::vector<NodeId> jobs; // what it is running, in batch order
     bool busy = false;
+    bool batch = false; // running a submit_batch()
   };
 
   std::vector<Worker> m_workers;
-  bool m_running = false;
+  std::vector<char> m_frame; // reused task payload buffer
+  std::deque<ResultMsg> m_results; // rest of a batch reply
+  WorkerOptions m_options;
+  std::vector<std::vector<int>> m_placement; // per worker, planned lazily
+  bool m_running = false; // at least one worker started
+
+  std::optional<ResultMsg> collect(timeval *timeout);
+  void spawn(size_t index);
+  Worker &claim(); // an idle worker, forked if needed
+  void append_commands(const Node &commands);
+  ResultMsg pop_result();
+  void fail_rest(const Worker &w, size_t reported);
+  void died(Worker &w, size_t reported);
 
+  static void apply_worker_options(const WorkerOptions &options,
+                                   const std::vector<int> &cpus);
   static void worker_loop(int read_fd, int write_fd);
 };
 
@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <format>
+#include <progress.hpp>
+#include <string>
+
+namespace exec {
+
+namespace {
+
+std::string fmt_eta(uint64_t us) {
+  const uint64_t s = (us + 500'000) / 1'000'000;
+  if (s >= 3600)
+    return std::format("{}h{:02}m", s / 3600, s / 60 % 60);
+  if (s >= 60)
+    return std::format("{}m{:02}s", s / 60, s % 60);
+  return std::format("{}s", s);
+}
+
+} // namespace
+
+Progress::Progress(std::ostream &out, bool terminal)
+    : m_out(out), m_terminal(terminal),
+      m_begin(std::chrono::steady_clock::now()), m_next_draw(m_begin) {}
+
+void Progress::add(uint64_t expected_us) noexcept {
+  m_total++;
+  if (expected_us != 0) {
+    m_known_left_us += expected_us;
+  } else {
+    m_unknown_left++;
+  }
+}
+
+void Progress::forget(uint64_t expected_us) noexcept {
+  if (expected_us != 0) {
+    m_known_left_us -= std::min(m_known_left_us, expected_us);
+  } else if (m_unknown_left != 0) {
+    m_unknown_left--;
+  }
+}
+
+void Progress::skipped(uint64_t expected_us) noexcept {
+  m_done++;
+  forget(expected_us);
+}
+
+void Progress::finished(uint64_t expected_us, uint64_t wall_us) noexcept {
+  m_done++;
+  m_ran++;
+  if (m_running != 0) {
+    m_running--;
+  }
+  m_ran_us += wall_us;
+  forget(expected_us);
+}
+
+void Progress::draw(std::chrono::steady_clock::time_point now) {
+  m_next_draw = now + (m_terminal ? redraw_interval : log_interval);
+
+  const auto elapsed_us = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(now - m_begin)
+          .count());
+  const double elapsed_s = static_cast<double>(elapsed_us) / 1e6;
+  const double rate =
+      elapsed_s > 0 ? static_cast<double>(m_ran) / elapsed_s : 0.0;
+
+  std::string line = std::format(
+      "[{}/{}] {} running, {} left, {:.1f} jobs/s", m_done, m_total, m_running,
+      m_total - m_done - m_running, rate);
+
+  const uint64_t avg_us = m_ran != 0 ? m_ran_us / m_ran : 0;
+  const uint64_t left_us = m_known_left_us + m_unknown_left * avg_us;
+  if (left_us != 0) {
+    // jobs overlap: scale by how much work per wall second we manage
+    double parallelism = static_cast<double>(std::max<uint64_t>(m_running, 1));
+    if (m_ran_us != 0 && elapsed_us != 0) {
+      parallelism = std::max(1.0, static_cast<double>(m_ran_us) /
+                                      static_cast<double>(elapsed_us));
+    }
+    line += ", ETA " + fmt_eta(static_cast<uint64_t>(
+                           static_cast<double>(left_us) / parallelism));
+  }
+
+  if (m_terminal) {
+    m_out << "\r\x1b[K" << line << std::flush;
+  } else {
+    m_out << line << '\n' << std::flush;
+  }
+}
+
+void Progress::done() {
+  draw(std::chrono::steady_clock::now());
+  if (m_terminal) {
+    m_out << '\n' << std::flush;
+  }
+}
+
+} // namespace exec
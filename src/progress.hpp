@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+namespace exec {
+
+// One-line build status (done/running/left, jobs/s, ETA) for stderr.
+// The scheduler feeds it events as nodes are counted, dispatched and
+// completed, so keeping it current is O(1) per event; the line itself is
+// redrawn at most every redraw_interval.
+//
+// ETA: remaining work is the recorded duration of every pending node, with
+// never-measured nodes costed at the average of this run's jobs so far,
+// divided by the parallelism observed so far.
+class Progress {
+public:
+  static constexpr auto redraw_interval = std::chrono::milliseconds(100);
+  // when the output is not a terminal, print a plain line this often
+  static constexpr auto log_interval = std::chrono::milliseconds(2000);
+
+  explicit Progress(std::ostream &out, bool terminal);
+
+  // a node that is part of this build; expected_us == 0 => never measured
+  void add(uint64_t expected_us) noexcept;
+
+  // node completed without running (up to date or no recipe)
+  void skipped(uint64_t expected_us) noexcept;
+  void started() noexcept { m_running++; }
+  void finished(uint64_t expected_us, uint64_t wall_us) noexcept;
+
+  // redraw if due
+  inline void tick() {
+    const auto now = std::chrono::steady_clock::now();
+    if (now >= m_next_draw) {
+      draw(now);
+    }
+  }
+
+  // final state, terminated by a newline
+  void done();
+
+private:
+  void draw(std::chrono::steady_clock::time_point now);
+  void forget(uint64_t expected_us) noexcept;
+
+  std::ostream &m_out;
+  bool m_terminal;
+  std::chrono::steady_clock::time_point m_begin;
+  std::chrono::steady_clock::time_point m_next_draw;
+
+  uint64_t m_total = 0;
+  uint64_t m_done = 0; // finished + skipped
+  uint64_t m_ran = 0;  // finished
+  uint64_t m_running = 0;
+
+  uint64_t m_known_left_us = 0; // recorded durations of pending nodes
+  uint64_t m_unknown_left = 0;  // pending nodes without a record
+  uint64_t m_ran_us = 0;        // measured wall time of finished jobs
+};
+
+} // namespace exec
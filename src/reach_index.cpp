@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <reach_index.hpp>
+#include <utility>
+
+namespace exec {
+
+namespace {
+
+using Interval = std::pair<uint32_t, uint32_t>;
+
+// sort and merge overlapping or adjacent intervals in place
+void merge_intervals(std::vector<Interval> &iv) {
+  std::sort(iv.begin(), iv.end());
+  size_t out = 0;
+  for (size_t i = 0; i < iv.size(); ++i) {
+    if (out != 0 && iv[i].first <= iv[out - 1].second + 1) {
+      iv[out - 1].second = std::max(iv[out - 1].second, iv[i].second);
+    } else {
+      iv[out++] = iv[i];
+    }
+  }
+  iv.resize(out);
+}
+
+} // namespace
+
+ReachIndex
+ReachIndex::build(const std::vector<std::vector<NodeId>> &children) {
+  const auto n = static_cast<NodeId>(children.size());
+
+  // 1. post-order numbering, DFS over dependents from every node that
+  // nothing depends on first (iterative: deep chains are common)
+  std::vector<uint32_t> post(n, 0);
+  std::vector<NodeId> by_post;
+  by_post.reserve(n);
+  std::vector<uint8_t> visited(n, 0);
+  std::vector<uint32_t> indeg(n, 0);
+  for (const auto &cs : children)
+    for (NodeId c : cs)
+      indeg[c]++;
+
+  std::vector<std::pair<NodeId, uint32_t>> st;
+  auto dfs = [&](NodeId root) {
+    visited[root] = 1;
+    st.emplace_back(root, 0);
+    while (!st.empty()) {
+      auto &[u, next] = st.back();
+      if (next < children[u].size()) {
+        const NodeId c = children[u][next++];
+        if (!visited[c]) {
+          visited[c] = 1;
+          st.emplace_back(c, 0);
+        }
+        continue;
+      }
+      post[u] = static_cast<uint32_t>(by_post.size());
+      by_post.push_back(u);
+      st.pop_back();
+    }
+  };
+  for (NodeId i = 0; i < n; ++i)
+    if (indeg[i] == 0 && !visited[i])
+      dfs(i);
+  for (NodeId i = 0; i < n; ++i)
+    if (!visited[i])
+      dfs(i); // only reachable through cycles
+
+  // 2. topological order (Kahn); nodes on or below a cycle never show up
+  std::vector<NodeId> order;
+  order.reserve(n);
+  for (NodeId i = 0; i < n; ++i)
+    if (indeg[i] == 0)
+      order.push_back(i);
+  for (size_t k = 0; k < order.size(); ++k)
+    for (NodeId c : children[order[k]])
+      if (--indeg[c] == 0)
+        order.push_back(c);
+
+  // 3. labels, dependents before their dependencies
+  std::vector<std::vector<Interval>> labels(n);
+  std::vector<uint8_t> indexed(n, 0);
+  std::vector<Interval> scratch;
+  for (auto it = order.rbegin(); it != order.rend(); ++it) {
+    const NodeId u = *it;
+    scratch.clear();
+    scratch.emplace_back(post[u], post[u]);
+
+    bool ok = true;
+    for (NodeId c : children[u]) {
+      if (!indexed[c]) {
+        ok = false;
+        break;
+      }
+      scratch.insert(scratch.end(), labels[c].begin(), labels[c].end());
+    }
+    if (!ok)
+      continue;
+
+    merge_intervals(scratch);
+    if (scratch.size() > max_intervals)
+      continue;
+    labels[u] = scratch;
+    indexed[u] = 1;
+  }
+
+  // 4. flatten
+  std::vector<uint32_t> offsets(n + 1, 0);
+  std::vector<uint32_t> intervals;
+  for (NodeId u = 0; u < n; ++u) {
+    offsets[u] = static_cast<uint32_t>(intervals.size());
+    for (const auto &[lo, hi] : labels[u]) {
+      intervals.push_back(lo);
+      intervals.push_back(hi);
+    }
+  }
+  offsets[n] = static_cast<uint32_t>(intervals.size());
+
+  std::vector<uint32_t> edge_offsets(n + 1, 0);
+  std::vector<NodeId> edges;
+  for (NodeId u = 0; u < n; ++u) {
+    edge_offsets[u] = static_cast<uint32_t>(edges.size());
+    if (!indexed[u]) {
+      edges.insert(edges.end(), children[u].begin(), children[u].end());
+    }
+  }
+  edge_offsets[n] = static_cast<uint32_t>(edges.size());
+
+  return ReachIndex(std::move(post), std::move(by_post), std::move(offsets),
+                    std::move(intervals), std::move(edge_offsets),
+                    std::move(edges));
+}
+
+bool ReachIndex::consistent(size_t n) const noexcept {
+  if (m_post.size() != n || m_by_post.size() != n || m_offsets.size() != n + 1 ||
+      m_offsets.back() != m_intervals.size() || m_intervals.size() % 2 != 0 ||
+      m_edge_offsets.size() != n + 1 || m_edge_offsets.back() != m_edges.size())
+    return false;
+  for (size_t i = 0; i < n; ++i) {
+    if (m_edge_offsets[i] > m_edge_offsets[i + 1])
+      return false;
+  }
+  for (NodeId c : m_edges) {
+    if (c >= n)
+      return false;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    if (m_post[i] >= n || m_by_post[m_post[i]] != i ||
+        m_offsets[i] > m_offsets[i + 1] || (m_offsets[i] % 2) != 0)
+      return false;
+  }
+  for (size_t k = 0; k < m_intervals.size(); k += 2) {
+    if (m_intervals[k] > m_intervals[k + 1] || m_intervals[k + 1] >= n)
+      return false;
+  }
+  return true;
+}
+
+std::vector<ReachIndex::NodeId>
+ReachIndex::descendants(std::span<const NodeId> from) const {
+  std::vector<Interval> iv;
+  std::vector<NodeId> found;
+
+  // unindexed sources: walk until an indexed node takes over; `walked`
+  // is what the walks reach through indexed nodes
+  std::vector<NodeId> st;
+  std::vector<uint8_t> seen;
+  std::vector<Interval> walked;
+  for (NodeId s : from) {
+    if (is_indexed(s)) {
+      for (uint32_t k = m_offsets[s]; k < m_offsets[s + 1]; k += 2)
+        iv.emplace_back(m_intervals[k], m_intervals[k + 1]);
+      continue;
+    }
+
+    if (seen.empty())
+      seen.assign(m_post.size(), 0);
+    st.push_back(s);
+    while (!st.empty()) {
+      const NodeId u = st.back();
+      st.pop_back();
+      for (uint32_t k = m_edge_offsets[u]; k < m_edge_offsets[u + 1]; ++k) {
+        const NodeId c = m_edges[k];
+        if (seen[c])
+          continue;
+        seen[c] = 1;
+        if (is_indexed(c)) {
+          for (uint32_t j = m_offsets[c]; j < m_offsets[c + 1]; j += 2)
+            walked.emplace_back(m_intervals[j], m_intervals[j + 1]);
+        } else {
+          found.push_back(c);
+          st.push_back(c);
+        }
+      }
+    }
+  }
+
+  merge_intervals(walked);
+  iv.insert(iv.end(), walked.begin(), walked.end());
+  merge_intervals(iv);
+  for (const auto &[lo, hi] : iv)
+    for (uint32_t p = lo; p <= hi; ++p)
+      found.push_back(m_by_post[p]);
+
+  // drop the sources (unless they depend on each other) and duplicates
+  std::sort(found.begin(), found.end(), [this](NodeId a, NodeId b) {
+    return m_post[a] > m_post[b];
+  });
+  found.erase(std::unique(found.begin(), found.end()), found.end());
+
+  // A source stays if another source reaches it: an unindexed one by its
+  // walk, an indexed one by its label without the source itself. `others`
+  // merges all of these so each source is tested once.
+  std::vector<uint8_t> is_source(m_post.size(), 0);
+  std::vector<Interval> others = std::move(walked);
+  for (NodeId s : from) {
+    is_source[s] = 1;
+    if (!is_indexed(s))
+      continue;
+    const uint32_t self = m_post[s];
+    for (uint32_t k = m_offsets[s]; k < m_offsets[s + 1]; k += 2) {
+      const uint32_t lo = m_intervals[k], hi = m_intervals[k + 1];
+      if (self < lo || self > hi) {
+        others.emplace_back(lo, hi);
+        continue;
+      }
+      if (lo < self)
+        others.emplace_back(lo, self - 1);
+      if (self < hi)
+        others.emplace_back(self + 1, hi);
+    }
+  }
+  merge_intervals(others);
+
+  constexpr uint32_t any = std::numeric_limits<uint32_t>::max();
+  std::erase_if(found, [&](NodeId u) {
+    if (!is_source[u] || (!seen.empty() && seen[u]))
+      return false;
+    auto it = std::upper_bound(others.begin(), others.end(),
+                               Interval{m_post[u], any});
+    return it == others.begin() || std::prev(it)->second < m_post[u];
+  });
+  return found;
+}
+
+} // namespace exec
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace exec {
+
+// Reachability index over the dependency DAG (edges point from a
+// dependency to its dependents).
+//
+// Nodes are numbered in DFS post-order. Each node stores the sorted,
+// merged post-order intervals covering itself and everything that depends
+// on it (tree-cover / compressed transitive closure). Descendants are then
+// enumerated straight from the intervals without touching the graph.
+// Nodes whose label would exceed max_intervals, or that sit on or below a
+// cycle, stay unindexed and are answered by traversal instead; the index
+// keeps their edges itself, so it stays exact when the graph's scheduling
+// edges are later optimized.
+class ReachIndex {
+public:
+  using NodeId = uint32_t;
+  static constexpr uint32_t max_intervals = 256;
+
+  ReachIndex() = default;
+  ReachIndex(std::vector<uint32_t> &&post, std::vector<NodeId> &&by_post,
+             std::vector<uint32_t> &&offsets, std::vector<uint32_t> &&intervals,
+             std::vector<uint32_t> &&edge_offsets, std::vector<NodeId> &&edges)
+      : m_post(std::move(post)), m_by_post(std::move(by_post)),
+        m_offsets(std::move(offsets)), m_intervals(std::move(intervals)),
+        m_edge_offsets(std::move(edge_offsets)), m_edges(std::move(edges)) {}
+
+  static ReachIndex build(const std::vector<std::vector<NodeId>> &children);
+
+  // not built (a default-constructed index)
+  inline bool empty() const noexcept { return m_offsets.empty(); }
+
+  // structural check for an index read back from the graph cache
+  bool consistent(size_t n) const noexcept;
+
+  // everything that transitively depends on any of `from` (excluding
+  // `from` themselves), in topological order
+  std::vector<NodeId> descendants(std::span<const NodeId> from) const;
+
+  // post-order number; a dependency always has a larger one than its
+  // dependents, so sorting by it descending is a build order
+  inline uint32_t post(NodeId id) const noexcept { return m_post[id]; }
+
+  inline bool is_indexed(NodeId id) const noexcept {
+    return m_offsets[id] != m_offsets[id + 1];
+  }
+
+  // flat [lo, hi] post-order pairs of an indexed node (itself included)
+  inline std::span<const uint32_t> label(NodeId id) const noexcept {
+    return {m_intervals.data() + m_offsets[id],
+            m_offsets[id + 1] - m_offsets[id]};
+  }
+
+  // raw arrays, for the graph cache
+  inline const std::vector<uint32_t> &post_numbers() const { return m_post; }
+  inline const std::vector<NodeId> &by_post() const { return m_by_post; }
+  inline const std::vector<uint32_t> &offsets() const { return m_offsets; }
+  inline const std::vector<uint32_t> &intervals() const { return m_intervals; }
+  inline const std::vector<uint32_t> &edge_offsets() const {
+    return m_edge_offsets;
+  }
+  inline const std::vector<NodeId> &edges() const { return m_edges; }
+
+private:
+  std::vector<uint32_t> m_post;    // node => post-order number
+  std::vector<NodeId> m_by_post;   // post-order number => node
+  std::vector<uint32_t> m_offsets; // CSR into m_intervals (in pairs), n + 1
+  std::vector<uint32_t> m_intervals; // flat [lo, hi] pairs
+  // CSR children of unindexed nodes (empty for indexed ones), n + 1
+  std::vector<uint32_t> m_edge_offsets;
+  std::vector<NodeId> m_edges;
+};
+
+} // namespace exec
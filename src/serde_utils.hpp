@@ -4,13 +4,25 @@
 #include <bit>
 #include <concepts>
 #include <cstdint>
+#include <cstring>
 #include <limits>
+#include <span>
 #include <string>
 #include <type_traits>
 #include <unordered_map>
 #include <utils.hpp>
 #include <vector>
 
+// Wire format (little-endian):
+//   trivially copyable T   raw bytes
+//   std::string            uint32_t size, bytes
+//   std::vector<T>         uint32_t size, elements
+//   map<K,V>               uint32_t size, (key, value) pairs
+//
+// Serialization is two-pass: serialized_size() computes the exact size,
+// then everything is written into one preallocated buffer. Vectors of
+// trivially copyable elements are copied in bulk on little-endian hosts.
+
 namespace serde {
 
 // concepts
@@ -25,204 +37,224 @@ concept IsMap =
     std::same_as<typename T::value_type, std::pair<const typename T::key_type,
                                                    typename T::mapped_type>>;
 
-// primitives
+template <typename T> struct is_std_vector : std::false_type {};
+
+template <typename T, typename Alloc>
+struct is_std_vector<std::vector<T, Alloc>> : std::true_type {};
+
+template <typename T>
+inline constexpr bool is_std_vector_v = is_std_vector<T>::value;
+
+template <typename T>
+concept IsValue = std::is_trivially_copyable_v<T>;
 
+// raw memcpy is the wire format for T on this host
 template <typename T>
-  requires std::is_trivially_copyable_v<T>
-inline std::array<std::byte, sizeof(T)> serialize_value(T value) noexcept {
+inline constexpr bool is_bulk_copyable_v =
+    IsValue<T> && (std::endian::native == std::endian::little ||
+                   !(std::is_integral_v<T> && sizeof(T) > 1));
+
+template <typename T> inline T to_wire(T value) noexcept {
   if constexpr (std::is_integral_v<T> && sizeof(T) > 1) {
     if constexpr (std::endian::native == std::endian::big) {
       value = std::byteswap(value);
     }
   }
-  return std::bit_cast<std::array<std::byte, sizeof(T)>>(value);
+  return value;
 }
 
-inline void serialize_string(const std::string &s,
-                             std::vector<std::byte> &dest) {
-  if (s.size() > std::numeric_limits<uint32_t>::max())
-    fatal("string too large");
-
-  auto sz = serialize_value<uint32_t>(static_cast<uint32_t>(s.size()));
-  dest.insert(dest.end(), sz.begin(), sz.end());
-
-  const auto *p = reinterpret_cast<const std::byte *>(s.data());
-  dest.insert(dest.end(), p, p + s.size());
+inline uint32_t checked_size(size_t size, const char *what) {
+  if (size > std::numeric_limits<uint32_t>::max())
+    fatal(what);
+  return static_cast<uint32_t>(size);
 }
 
-// vector<T>
+// size pass
 
 template <typename T>
-  requires(std::is_trivially_copyable_v<T> || std::same_as<T, std::string>)
-void serialize_vec(const std::vector<T> &v, std::vector<std::byte> &dest) {
-  if (v.size() > std::numeric_limits<uint32_t>::max())
-    fatal("vector too large");
+  requires IsValue<T>
+constexpr size_t serialized_size(const T &) noexcept {
+  return sizeof(T);
+}
 
-  auto sz = serialize_value<uint32_t>(static_cast<uint32_t>(v.size()));
-  dest.insert(dest.end(), sz.begin(), sz.end());
+inline size_t serialized_size(const std::string &s) {
+  return sizeof(uint32_t) + s.size();
+}
 
-  for (const T &x : v) {
-    if constexpr (std::same_as<T, std::string>) {
-      serialize_string(x, dest);
-    } else {
-      auto bytes = serialize_value(x);
-      dest.insert(dest.end(), bytes.begin(), bytes.end());
+template <typename T> size_t serialized_size(const std::vector<T> &v) {
+  checked_size(v.size(), "vector too large");
+  if constexpr (IsValue<T>) {
+    return sizeof(uint32_t) + v.size() * sizeof(T);
+  } else {
+    size_t n = sizeof(uint32_t);
+    for (const auto &x : v) {
+      n += serialized_size(x);
     }
+    return n;
   }
 }
 
-// vector<vector<T>>...
-
 template <typename T>
-void serialize_vec(const std::vector<std::vector<T>> &v,
-                   std::vector<std::byte> &dest) {
-  if (v.size() > std::numeric_limits<uint32_t>::max())
-    fatal("outer vector too large");
-
-  auto sz = serialize_value<uint32_t>(static_cast<uint32_t>(v.size()));
-  dest.insert(dest.end(), sz.begin(), sz.end());
-
-  for (const auto &inner : v) {
-    serialize_vec(inner, dest);
+  requires IsMap<T>
+size_t serialized_size(const T &m) {
+  checked_size(m.size(), "map too large");
+  size_t n = sizeof(uint32_t);
+  for (const auto &[k, v] : m) {
+    n += serialized_size(k) + serialized_size(v);
   }
+  return n;
 }
 
-// map<K,V>
+// write pass (caller guarantees the room, see serialize_all)
 
 template <typename T>
-  requires IsMap<T>
-void serialize_map(const T &m, std::vector<std::byte> &dest) {
-  using K = typename T::key_type;
-  using V = typename T::mapped_type;
-
-  if (m.size() > std::numeric_limits<uint32_t>::max())
-    fatal("map too large");
+  requires IsValue<T>
+inline void write_into(const T &value, std::byte *&out) noexcept {
+  const T wire = to_wire(value);
+  std::memcpy(out, &wire, sizeof(T));
+  out += sizeof(T);
+}
 
-  auto sz = serialize_value<uint32_t>(static_cast<uint32_t>(m.size()));
-  dest.insert(dest.end(), sz.begin(), sz.end());
+inline void write_into(const std::string &s, std::byte *&out) {
+  write_into(checked_size(s.size(), "string too large"), out);
+  std::memcpy(out, s.data(), s.size());
+  out += s.size();
+}
 
-  for (const auto &[k, v] : m) {
-    if constexpr (std::same_as<K, std::string>) {
-      serialize_string(k, dest);
-    } else {
-      auto kb = serialize_value(k);
-      dest.insert(dest.end(), kb.begin(), kb.end());
+template <typename T>
+void write_into(const std::vector<T> &v, std::byte *&out) {
+  write_into(checked_size(v.size(), "vector too large"), out);
+  if constexpr (is_bulk_copyable_v<T>) {
+    if (!v.empty()) {
+      std::memcpy(out, v.data(), v.size() * sizeof(T));
+      out += v.size() * sizeof(T);
     }
-
-    if constexpr (std::same_as<V, std::string>) {
-      serialize_string(v, dest);
-    } else {
-      auto vb = serialize_value(v);
-      dest.insert(dest.end(), vb.begin(), vb.end());
+  } else {
+    for (const auto &x : v) {
+      write_into(x, out);
     }
   }
 }
 
-} // namespace serde
-
-namespace serde {
-
-// primitives
-
 template <typename T>
-  requires std::is_trivially_copyable_v<T>
-inline T deserialize_value(const std::byte *&ptr) {
-  auto arr = std::bit_cast<T>(
-      *reinterpret_cast<const std::array<std::byte, sizeof(T)> *>(ptr));
-  ptr += sizeof(T);
-
-  if constexpr (std::is_integral_v<T> && sizeof(T) > 1) {
-    if constexpr (std::endian::native == std::endian::big) {
-      arr = std::byteswap(arr);
-    }
+  requires IsMap<T>
+void write_into(const T &m, std::byte *&out) {
+  write_into(checked_size(m.size(), "map too large"), out);
+  for (const auto &[k, v] : m) {
+    write_into(k, out);
+    write_into(v, out);
   }
-  return arr;
 }
 
-inline std::string deserialize_string(const std::byte *&ptr) {
-  uint32_t sz = deserialize_value<uint32_t>(ptr);
-  std::string s(reinterpret_cast<const char *>(ptr), sz);
-  ptr += sz;
-  return s;
-}
-
-// vector<T> and nested ones
-
-template <typename T> struct is_std_vector : std::false_type {};
-
-template <typename T, typename Alloc>
-struct is_std_vector<std::vector<T, Alloc>> : std::true_type {};
-
-template <typename T>
-inline constexpr bool is_std_vector_v = is_std_vector<T>::value;
-
-template <typename T> struct vector_inner;
-
-template <typename T, typename Alloc>
-struct vector_inner<std::vector<T, Alloc>> {
-  using type = T;
-};
-
-template <typename T> T deserialize_vec(const std::byte *&ptr);
-
-template <typename T>
-  requires std::is_trivially_copyable_v<T>
-T deserialize_vec(const std::byte *&ptr) {
-  return deserialize_value<T>(ptr);
+// One exactly sized buffer holding all `parts` back to back.
+template <typename... Ts>
+std::vector<std::byte> serialize_all(const Ts &...parts) {
+  const size_t total = (serialized_size(parts) + ... + 0);
+  std::vector<std::byte> buffer(total);
+  std::byte *out = buffer.data();
+  (write_into(parts, out), ...);
+  return buffer;
 }
 
-template <>
-inline std::string deserialize_vec<std::string>(const std::byte *&ptr) {
-  return deserialize_string(ptr);
-}
+// Bounds-checked reader over a byte span. Running past the end (or a size
+// prefix that can't fit in what's left) puts the reader in a failed state:
+// further reads return empty values and ok() stays false.
+class Reader {
+public:
+  explicit Reader(std::span<const std::byte> data) noexcept : m_data(data) {}
 
-template <typename T>
-  requires is_std_vector_v<T>
-T deserialize_vec(const std::byte *&ptr) {
-  using Inner = typename vector_inner<T>::type;
+  inline bool ok() const noexcept { return m_ok; }
+  inline bool at_end() const noexcept {
+    return m_ok && m_pos == m_data.size();
+  }
 
-  uint32_t sz = deserialize_value<uint32_t>(ptr);
-  T vec;
-  vec.reserve(sz);
+  template <typename T> T read() {
+    if constexpr (IsValue<T>) {
+      T value{};
+      if (const std::byte *p = take(sizeof(T))) {
+        std::memcpy(&value, p, sizeof(T));
+        value = to_wire(value);
+      }
+      return value;
+    } else if constexpr (std::same_as<T, std::string>) {
+      const auto size = read<uint32_t>();
+      const std::byte *p = take(size);
+      return p ? std::string(reinterpret_cast<const char *>(p), size)
+               : std::string();
+    } else if constexpr (is_std_vector_v<T>) {
+      return read_vec<T>();
+    } else {
+      static_assert(IsMap<T>, "serde: unsupported type");
+      return read_map<T>();
+    }
+  }
 
-  for (uint32_t i = 0; i < sz; ++i) {
-    vec.emplace_back(deserialize_vec<Inner>(ptr));
+private:
+  template <typename T> static constexpr size_t min_size() {
+    if constexpr (IsValue<T>)
+      return sizeof(T);
+    else
+      return sizeof(uint32_t); // size-prefixed
   }
-  return vec;
-}
 
-// map<K,V>
+  const std::byte *take(size_t n) noexcept {
+    if (!m_ok || n > m_data.size() - m_pos) {
+      m_ok = false;
+      return nullptr;
+    }
+    const std::byte *p = m_data.data() + m_pos;
+    m_pos += n;
+    return p;
+  }
 
-template <typename T>
-  requires serde::IsMap<T>
-T deserialize_map(const std::byte *&ptr) {
-  using K = typename T::key_type;
-  using V = typename T::mapped_type;
-
-  uint32_t sz = deserialize_value<uint32_t>(ptr);
-  T m;
-  m.reserve(sz);
-
-  for (uint32_t i = 0; i < sz; ++i) {
-    K k = [&] {
-      if constexpr (std::same_as<K, std::string>) {
-        return deserialize_string(ptr);
-      } else {
-        return deserialize_value<K>(ptr);
-      }
-    }();
+  // reject counts that can't possibly fit before allocating for them
+  bool plausible(uint32_t count, size_t elem_min) noexcept {
+    if (m_ok && count > (m_data.size() - m_pos) / elem_min)
+      m_ok = false;
+    return m_ok;
+  }
 
-    V v = [&] {
-      if constexpr (std::same_as<V, std::string>) {
-        return deserialize_string(ptr);
-      } else {
-        return deserialize_value<V>(ptr);
+  template <typename T> T read_vec() {
+    using Inner = typename T::value_type;
+    const auto count = read<uint32_t>();
+    T vec;
+    if (!plausible(count, min_size<Inner>()))
+      return vec;
+
+    if constexpr (is_bulk_copyable_v<Inner>) {
+      vec.resize(count);
+      if (count != 0)
+        std::memcpy(vec.data(), take(count * sizeof(Inner)),
+                    count * sizeof(Inner));
+    } else {
+      vec.reserve(count);
+      for (uint32_t i = 0; i < count && m_ok; ++i) {
+        vec.emplace_back(read<Inner>());
       }
-    }();
+    }
+    return vec;
+  }
 
-    m.emplace(std::move(k), std::move(v));
+  template <typename T> T read_map() {
+    using K = typename T::key_type;
+    using V = typename T::mapped_type;
+    const auto count = read<uint32_t>();
+    T m;
+    if (!plausible(count, min_size<K>() + min_size<V>()))
+      return m;
+
+    m.reserve(count);
+    for (uint32_t i = 0; i < count && m_ok; ++i) {
+      K k = read<K>();
+      V v = read<V>();
+      m.emplace(std::move(k), std::move(v));
+    }
+    return m;
   }
-  return m;
-}
+
+  std::span<const std::byte> m_data;
+  size_t m_pos = 0;
+  bool m_ok = true;
+};
 
 } // namespace serde
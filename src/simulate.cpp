@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <format>
+#include <simulate.hpp>
+#include <utils.hpp>
+
+namespace exec {
+
+std::vector<uint64_t> SimExecutor::durations_from(const Graph &graph,
+                                                  const BuildHistory &history,
+                                                  uint64_t default_us) {
+  const NodeId n = static_cast<NodeId>(graph.size());
+  std::vector<uint64_t> durations(n, 0);
+  std::vector<NodeId> unknown;
+  uint64_t known_sum = 0, known = 0;
+
+  for (NodeId i = 0; i < n; ++i) {
+    const uint64_t d = history.expected_wall_us(*graph.get_name_ref(i));
+    if (d == 0) {
+      unknown.push_back(i);
+    } else {
+      durations[i] = d;
+      known_sum += d;
+      known++;
+    }
+  }
+
+  const uint64_t fill = known ? known_sum / known : default_us;
+  for (NodeId i : unknown) {
+    durations[i] = fill;
+  }
+  return durations;
+}
+
+void SimExecutor::submit(NodeId id, const Node &, bool) {
+  const uint64_t end = m_now + m_durations[id];
+  m_running.emplace(end, id);
+  m_timeline.push_back(Span{id, m_now, end});
+}
+
+ResultMsg SimExecutor::wait_result() {
+  const auto [end, id] = m_running.top();
+  m_running.pop();
+  m_now = end;
+
+  ResultMsg res{};
+  res.node_id = id;
+  res.wall_us = m_durations[id];
+  return res;
+}
+
+void report_simulation(const Graph &graph, const DyndepOverlay &overlay,
+                       const SimExecutor &sim,
+                       std::chrono::nanoseconds scheduler_time,
+                       std::ostream &out) {
+  const auto &timeline = sim.timeline();
+  if (timeline.empty()) {
+    out << "nothing to run\n";
+    return;
+  }
+
+  const uint64_t makespan = sim.now_us();
+  uint64_t work = 0;
+  for (const auto &span : timeline) {
+    work += span.end_us - span.start_us;
+  }
+
+  // Critical path over the jobs that ran. Spans are in start order, which
+  // is a topological order: a job starts after all its dependencies ended.
+  const NodeId n = static_cast<NodeId>(graph.size());
+  std::vector<uint64_t> path_end(n, 0);
+  std::vector<NodeId> pred(n, Graph::npos);
+  NodeId last = Graph::npos;
+  for (const auto &span : timeline) {
+    uint64_t longest = 0;
+    auto extend = [&](NodeId p) {
+      if (path_end[p] > longest) {
+        longest = path_end[p];
+        pred[span.id] = p;
+      }
+    };
+    for (NodeId p : graph.get_parent_ids(span.id)) {
+      extend(p);
+    }
+    for (NodeId p : graph.get_order_only_ids(span.id)) {
+      extend(p);
+    }
+    for (NodeId p : overlay.parents(span.id)) {
+      extend(p);
+    }
+    path_end[span.id] = longest + (span.end_us - span.start_us);
+    if (last == Graph::npos || path_end[span.id] > path_end[last]) {
+      last = span.id;
+    }
+  }
+  const uint64_t critical = path_end[last];
+  const uint64_t lower_bound =
+      std::max<uint64_t>(critical, work / sim.slots());
+
+  out << std::format("jobs:             {}\n", timeline.size());
+  out << std::format("makespan:         {}\n", fmt_us(makespan));
+  out << std::format("total work:       {}\n", fmt_us(work));
+  out << std::format("utilization:      {:.1f}% of {} workers\n",
+                     100.0 * static_cast<double>(work) /
+                         static_cast<double>(makespan * sim.slots()),
+                     sim.slots());
+  out << std::format("critical path:    {}\n", fmt_us(critical));
+  out << std::format("slack:            {} over the critical path, {} over "
+                     "the lower bound\n",
+                     fmt_us(makespan - critical),
+                     fmt_us(makespan - lower_bound));
+  out << std::format("scheduler time:   {:.2f}us per job\n",
+                     static_cast<double>(scheduler_time.count()) / 1e3 /
+                         static_cast<double>(timeline.size()));
+
+  std::vector<NodeId> chain;
+  for (NodeId u = last; u != Graph::npos; u = pred[u]) {
+    chain.push_back(u);
+  }
+  out << "\ncritical path (goal last):\n";
+  const size_t shown = std::min<size_t>(chain.size(), 10);
+  if (shown < chain.size()) {
+    out << std::format("  ... {} more\n", chain.size() - shown);
+  }
+  for (size_t i = shown; i-- > 0;) {
+    const NodeId u = chain[i];
+    out << std::format("  {:>10}  {}\n", fmt_us(path_end[u]),
+                       *graph.get_name_ref(u));
+  }
+}
+
+} // namespace exec
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <exec.hpp>
+#include <executor.hpp>
+#include <history.hpp>
+#include <ostream>
+#include <queue>
+#include <vector>
+
+namespace exec {
+
+// Discrete-event executor: a job takes its recorded (or modelled) duration
+// on a virtual clock, `slots` jobs at a time. Nothing is actually run.
+class SimExecutor final : public Executor {
+public:
+  struct Span {
+    NodeId id;
+    uint64_t start_us;
+    uint64_t end_us;
+  };
+
+  // durations_us is indexed by NodeId
+  SimExecutor(size_t slots, std::vector<uint64_t> durations_us)
+      : m_slots(slots), m_durations(std::move(durations_us)) {}
+
+  // recorded durations, unknown nodes get the mean of the known ones
+  // (or default_us when nothing is known)
+  static std::vector<uint64_t> durations_from(const Graph &graph,
+                                              const BuildHistory &history,
+                                              uint64_t default_us = 1'000'000);
+
+  bool can_accept() const override { return m_running.size() < m_slots; }
+  void submit(NodeId id, const Node &commands, bool builtin) override;
+  ResultMsg wait_result() override;
+  void shutdown() override {}
+
+  inline uint64_t now_us() const noexcept { return m_now; }
+  inline size_t slots() const noexcept override { return m_slots; }
+  inline const std::vector<Span> &timeline() const noexcept {
+    return m_timeline;
+  }
+
+private:
+  using Running = std::pair<uint64_t, NodeId>; // (end, node)
+
+  size_t m_slots;
+  std::vector<uint64_t> m_durations;
+  uint64_t m_now = 0;
+  std::priority_queue<Running, std::vector<Running>, std::greater<>> m_running;
+  std::vector<Span> m_timeline;
+};
+
+// `buildir --simulate`: makespan, utilization, critical path and slack,
+// plus the scheduler's own (real) time per dispatched job. `overlay` holds
+// the dyndep edges loaded during the run.
+void report_simulation(const Graph &graph, const DyndepOverlay &overlay,
+                       const SimExecutor &sim,
+                       std::chrono::nanoseconds scheduler_time,
+                       std::ostream &out);
+
+} // namespace exec
@@ -0,0 +1,181 @@
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cstdlib>
+#include <fcntl.h>
+#include <format>
+#include <new>
+#include <stats.hpp>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+
+namespace stats {
+
+namespace {
+
+std::atomic<uint64_t> g_allocs{0};
+std::atomic<uint64_t> g_alloc_bytes{0};
+bool g_enabled = false;
+
+struct PhaseTotals {
+  uint64_t entries = 0;
+  uint64_t nanos = 0;
+  uint64_t allocs = 0;
+  uint64_t alloc_bytes = 0;
+  uint64_t syscalls = 0;
+};
+
+std::array<PhaseTotals, static_cast<size_t>(Phase::Count)> g_totals{};
+
+constexpr std::array<std::string_view, static_cast<size_t>(Phase::Count)>
+    phase_names = {"read_lines",      "parse",      "graph_build",
+                   "graph_deserialize", "graph_serialize", "pool_start",
+                   "schedule",        "stat_checks", "fingerprint"};
+
+constexpr bool is_fine_grained(Phase phase) {
+  return phase == Phase::StatChecks;
+}
+
+// read-type + write-type syscalls of this process (syscr + syscw), 0 if
+// unavailable. Parsed from a fixed buffer so a Scope can't throw.
+uint64_t rw_syscalls() noexcept {
+  char buf[512];
+  const int fd = ::open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return 0;
+  const ssize_t len = ::read(fd, buf, sizeof(buf));
+  ::close(fd);
+  if (len <= 0)
+    return 0;
+
+  const std::string_view text(buf, static_cast<size_t>(len));
+  uint64_t total = 0;
+  for (const std::string_view key : {"syscr: ", "syscw: "}) {
+    const size_t at = text.find(key);
+    if (at == std::string_view::npos)
+      continue;
+    uint64_t value = 0;
+    std::from_chars(text.data() + at + key.size(), text.data() + text.size(),
+                    value);
+    total += value;
+  }
+  return total;
+}
+
+} // namespace
+
+void enable() noexcept { g_enabled = true; }
+bool enabled() noexcept { return g_enabled; }
+
+Scope::Scope(Phase phase) noexcept : m_phase(phase), m_active(g_enabled) {
+  if (!m_active)
+    return;
+  if (!is_fine_grained(phase))
+    m_syscalls = rw_syscalls();
+  m_allocs = g_allocs.load(std::memory_order_relaxed);
+  m_alloc_bytes = g_alloc_bytes.load(std::memory_order_relaxed);
+  m_start = std::chrono::steady_clock::now();
+}
+
+Scope::~Scope() {
+  if (!m_active)
+    return;
+
+  const auto elapsed = std::chrono::steady_clock::now() - m_start;
+  auto &t = g_totals[static_cast<size_t>(m_phase)];
+  t.entries++;
+  t.nanos += static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  t.allocs += g_allocs.load(std::memory_order_relaxed) - m_allocs;
+  t.alloc_bytes += g_alloc_bytes.load(std::memory_order_relaxed) - m_alloc_bytes;
+  if (!is_fine_grained(m_phase)) {
+    const uint64_t now = rw_syscalls();
+    t.syscalls += now >= m_syscalls ? now - m_syscalls : 0;
+  }
+}
+
+void report(std::ostream &out, bool json) {
+#ifdef BUILDIR_ALLOC_STATS
+  constexpr bool count_allocs = true;
+#else
+  constexpr bool count_allocs = false;
+#endif
+
+  if (json) {
+    out << "{\"alloc_counting\": " << (count_allocs ? "true" : "false")
+        << ", \"phases\": [";
+    bool first = true;
+    for (size_t i = 0; i < g_totals.size(); ++i) {
+      const auto &t = g_totals[i];
+      if (t.entries == 0)
+        continue;
+      out << (first ? "" : ", ")
+          << std::format("{{\"phase\": \"{}\", \"entries\": {}, "
+                         "\"time_us\": {}, \"allocs\": {}, "
+                         "\"alloc_bytes\": {}, \"rw_syscalls\": {}}}",
+                         phase_names[i], t.entries, t.nanos / 1000, t.allocs,
+                         t.alloc_bytes,
+                         is_fine_grained(static_cast<Phase>(i))
+                             ? std::string("null")
+                             : std::to_string(t.syscalls));
+      first = false;
+    }
+    out << "]}\n";
+    return;
+  }
+
+  out << std::format("{:<18} {:>8} {:>12} {:>10} {:>12} {:>19}\n", "phase",
+                     "entries", "time", "allocs", "alloc bytes",
+                     "read/write syscalls");
+  for (size_t i = 0; i < g_totals.size(); ++i) {
+    const auto &t = g_totals[i];
+    if (t.entries == 0)
+      continue;
+    out << std::format(
+        "{:<18} {:>8} {:>10.3f}ms {:>10} {:>12} {:>19}\n", phase_names[i],
+        t.entries, static_cast<double>(t.nanos) / 1e6,
+        count_allocs ? std::to_string(t.allocs) : "-",
+        count_allocs ? std::to_string(t.alloc_bytes) : "-",
+        is_fine_grained(static_cast<Phase>(i)) ? "-"
+                                               : std::to_string(t.syscalls));
+  }
+  out << "(phases nest and are reported inclusively; read/write syscalls "
+         "come from /proc/self/io and leave out stat, open, fork and the "
+         "like; - = not measured)\n";
+}
+
+} // namespace stats
+
+#ifdef BUILDIR_ALLOC_STATS
+
+// Counting replacements for the global allocation functions.
+
+void *operator new(std::size_t size) {
+  stats::g_allocs.fetch_add(1, std::memory_order_relaxed);
+  stats::g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) { return ::operator new(size); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return ::operator new(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return ::operator new(size, std::nothrow);
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+#endif
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Per-phase instrumentation for --stats: wall time, number of entries,
+// allocations (when built with BUILDIR_ALLOC_STATS) and read/write syscalls
+// (the read- and write-type calls counted by /proc/self/io; stat, open,
+// fork and the like don't show up there). Everything is a no-op until
+// enable() is called.
+namespace stats {
+
+enum class Phase : uint8_t {
+  ReadLines,
+  Parse,
+  GraphBuild,
+  GraphDeserialize,
+  GraphSerialize,
+  PoolStart,
+  Schedule,
+  StatChecks,
+  Fingerprint,
+  Count
+};
+
+void enable() noexcept;
+bool enabled() noexcept;
+
+// Accumulates into `phase` for its lifetime. Phases may nest; each one is
+// reported inclusively. Fine-grained phases (entered once per node) skip
+// the syscall counters, reading them costs syscalls of its own.
+class Scope {
+public:
+  explicit Scope(Phase phase) noexcept;
+  ~Scope();
+
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+
+private:
+  Phase m_phase;
+  bool m_active;
+  std::chrono::steady_clock::time_point m_start;
+  uint64_t m_allocs = 0;
+  uint64_t m_alloc_bytes = 0;
+  uint64_t m_syscalls = 0;
+};
+
+void report(std::ostream &out, bool json);
+
+} // namespace stats
@@ -0,0 +1,330 @@
+#include <algorithm>
+#include <builtin.hpp>
+#include <file_reader.hpp>
+#include <filesystem>
+#include <fstream>
+#include <stream.hpp>
+#include <thread>
+#include <utils.hpp>
+
+namespace exec {
+
+parse::Result StreamBuild::run(const std::string &path) {
+  // errors must not exit() from the reader thread: the file is checked
+  // here, syntax errors are handed back with the last chunk
+  if (!std::ifstream(path)) {
+    fatal("failed to open file");
+  }
+
+  // jobs are submitted while the reader runs: no forking after it started
+  m_pool.start();
+
+  std::jthread reader([this, &path] {
+    FileReader file(path);
+    parse::StreamParser parser;
+    size_t lines = 0;
+
+    auto publish = [this, &parser](bool eof) {
+      auto chunk = parser.take();
+      {
+        std::lock_guard lock(m_mutex);
+        m_chunks.push_back(std::move(chunk));
+        m_eof = eof;
+        if (eof) {
+          m_parse_error = parser.error();
+        }
+      }
+      m_cv.notify_one();
+    };
+
+    file.for_each_line([&](std::string &line) {
+      if (parser.error()) {
+        return; // skip to the end
+      }
+      parser.feed(line);
+      if (++lines % chunk_lines == 0) {
+        publish(false);
+      }
+    });
+    parser.finish();
+    publish(true);
+  });
+
+  parse::Result all;
+  auto append = [](auto &into, auto &from) {
+    into.insert(into.end(), std::make_move_iterator(from.begin()),
+                std::make_move_iterator(from.end()));
+  };
+
+  for (;;) {
+    std::deque<parse::Result> chunks;
+    bool eof, failed;
+    {
+      std::unique_lock lock(m_mutex);
+      if (m_running == 0) {
+        m_cv.wait(lock, [this] { return !m_chunks.empty() || m_eof; });
+      }
+      chunks.swap(m_chunks);
+      eof = m_eof;
+      failed = m_parse_error.has_value();
+    }
+    if (failed) {
+      break; // start nothing more
+    }
+
+    for (auto &chunk : chunks) {
+      apply(chunk);
+      append(all.phony, chunk.phony);
+      append(all.rules, chunk.rules);
+      append(all.pattern_rules, chunk.pattern_rules);
+      append(all.pools, chunk.pools);
+      append(all.pool_members, chunk.pool_members);
+      append(all.dyndeps, chunk.dyndeps);
+    }
+    dispatch();
+
+    if (eof) {
+      break;
+    }
+    if (m_running > 0) {
+      if (auto res = m_pool.wait_result_for(std::chrono::milliseconds(2))) {
+        on_result(*res);
+      }
+    }
+  }
+
+  reader.join();
+  if (m_parse_error) {
+    m_pool.shutdown();
+    m_history.save();
+    fatal(m_parse_error->c_str());
+  }
+  return all;
+}
+
+void StreamBuild::finish() {
+  while (m_running > 0) {
+    on_result(m_pool.wait_result());
+  }
+}
+
+uint32_t StreamBuild::intern(const std::string &name) {
+  auto [it, inserted] =
+      m_ids.emplace(name, static_cast<uint32_t>(m_names.size()));
+  if (inserted) {
+    m_names.push_back(name);
+    m_nodes.emplace_back();
+  }
+  return it->second;
+}
+
+void StreamBuild::apply(parse::Result &chunk) {
+  // directives and patterns of a chunk are taken before its rules
+  for (const auto &p : chunk.phony) {
+    m_phony.insert(p);
+  }
+  for (const auto &pool : chunk.pools) {
+    m_pool_depth.emplace(pool.name, pool.depth);
+  }
+  for (const auto &[pool, target] : chunk.pool_members) {
+    m_pool_of[target] = pool;
+  }
+  for (const auto &rule : chunk.pattern_rules) {
+    m_patterns.push_back(rule.name);
+  }
+  for (const auto &d : chunk.dyndeps) {
+    m_dyndeps.insert(d);
+  }
+
+  for (const auto &rule : chunk.rules) {
+    if (!rule.grouped.empty()) {
+      continue; // outputs only share a node in the Graph
+    }
+    const uint32_t id = intern(rule.name);
+    if (m_nodes[id].has_rule) {
+      continue; // duplicate, Graph::build reports it
+    }
+
+    std::vector<uint32_t> deps;
+    deps.reserve(rule.deps.size() + rule.order_only.size());
+    for (const auto &dep : rule.deps) {
+      deps.push_back(intern(dep));
+    }
+    for (const auto &dep : rule.order_only) {
+      deps.push_back(intern(dep));
+    }
+
+    EarlyNode &node = m_nodes[id];
+    node.has_rule = true;
+    node.commands = rule.commands;
+    node.deps = std::move(deps);
+    node.n_checked = static_cast<uint32_t>(rule.deps.size());
+    for (uint32_t d : node.deps) {
+      m_nodes[d].dependents.push_back(id);
+      if (m_nodes[d].state != State::Done) {
+        node.waiting++;
+      }
+    }
+
+    if (rule.name == m_goal) {
+      mark_needed(id);
+    } else if (node.needed) {
+      // needed before its rule was known: pass it on
+      node.needed = false;
+      mark_needed(id);
+    }
+    try_ready(id);
+  }
+}
+
+void StreamBuild::mark_needed(uint32_t id) {
+  std::vector<uint32_t> st{id};
+  while (!st.empty()) {
+    const uint32_t u = st.back();
+    st.pop_back();
+    if (m_nodes[u].needed) {
+      continue;
+    }
+    m_nodes[u].needed = true;
+    for (uint32_t d : m_nodes[u].deps) {
+      st.push_back(d);
+    }
+    try_ready(u);
+  }
+}
+
+void StreamBuild::try_ready(uint32_t id) {
+  EarlyNode &node = m_nodes[id];
+  if (!node.has_rule || !node.needed || node.waiting != 0 ||
+      node.state != State::Idle) {
+    return;
+  }
+  // a recipe-less rule may still take its recipe from a pattern
+  if (node.commands.empty()) {
+    for (const auto &pattern : m_patterns) {
+      if (match_pattern(pattern, m_names[id])) {
+        return;
+      }
+    }
+  }
+  // edges from a dyndep file are only added by Scheduler::run
+  for (uint32_t d : node.deps) {
+    if (m_dyndeps.contains(m_names[d])) {
+      return;
+    }
+  }
+  node.state = State::Ready;
+  m_ready.push_back(id);
+}
+
+// same test as Scheduler::run, on what is known so far
+bool StreamBuild::out_of_date(uint32_t id) const {
+  const std::string &target = m_names[id];
+  if (m_phony.contains(target) || !std::filesystem::exists(target)) {
+    return true;
+  }
+  const auto &deps = m_nodes[id].deps;
+  for (uint32_t k = 0; k < m_nodes[id].n_checked; ++k) {
+    if (is_newer(m_names[deps[k]], target)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void StreamBuild::dispatch() {
+  while (!m_ready.empty() && m_pool.can_accept()) {
+    const uint32_t id = m_ready.front();
+    m_ready.pop_front();
+    EarlyNode &node = m_nodes[id];
+
+    if (node.commands.empty() || !out_of_date(id)) {
+      complete(id, false);
+      continue;
+    }
+
+    if (auto pit = m_pool_of.find(m_names[id]); pit != m_pool_of.end()) {
+      auto dit = m_pool_depth.find(pit->second);
+      if (dit != m_pool_depth.end()) {
+        uint32_t &running = m_pool_running[pit->second];
+        if (running >= dit->second) {
+          m_pool_waiting[pit->second].push_back(id);
+          continue;
+        }
+        running++;
+      }
+    }
+
+    const bool builtin_only =
+        std::all_of(node.commands.begin(), node.commands.end(),
+                    [](const std::string &cmd) {
+                      return builtin::recognizes(cmd);
+                    });
+    node.state = State::Running;
+    m_pool.submit(id, node.commands, builtin_only);
+    m_running++;
+  }
+}
+
+void StreamBuild::complete(uint32_t id, bool ran) {
+  m_nodes[id].state = State::Done;
+  m_nodes[id].ran = ran;
+  m_completed.push_back(id);
+  for (uint32_t v : m_nodes[id].dependents) {
+    if (--m_nodes[v].waiting == 0) {
+      try_ready(v);
+    }
+  }
+}
+
+void StreamBuild::on_result(const ResultMsg &res) {
+  m_running--;
+  const uint32_t id = res.node_id;
+  m_history.record(m_names[id], res);
+
+  if (res.exit_code != 0) {
+    m_pool.shutdown();
+    m_history.save();
+    fatal("command failed");
+  }
+
+  if (auto pit = m_pool_of.find(m_names[id]); pit != m_pool_of.end()) {
+    if (m_pool_depth.contains(pit->second)) {
+      m_pool_running[pit->second]--;
+      auto &waiting = m_pool_waiting[pit->second];
+      if (!waiting.empty()) {
+        m_ready.push_front(waiting.front());
+        waiting.pop_front();
+      }
+    }
+  }
+
+  complete(id, true);
+  dispatch();
+}
+
+std::vector<NodeId> StreamBuild::prebuilt(const Graph &graph) const {
+  std::vector<uint8_t> ok(graph.size(), 0);
+  std::vector<NodeId> out;
+
+  // completion order is a topological order, prerequisites come first
+  for (uint32_t early : m_completed) {
+    const NodeId id = graph.get_id(m_names[early]);
+    if (id == Graph::npos || graph.is_templated(id) ||
+        (graph.is_phony(id) && !m_nodes[early].ran)) {
+      continue;
+    }
+    auto settled = [&](NodeId p) { return ok[p] != 0 && !graph.is_dyndep(p); };
+    const auto parents = graph.get_parent_ids(id);
+    const auto order_only = graph.get_order_only_ids(id);
+    if (!std::all_of(parents.begin(), parents.end(), settled) ||
+        !std::all_of(order_only.begin(), order_only.end(), settled)) {
+      continue;
+    }
+    ok[id] = 1;
+    out.push_back(id);
+  }
+  return out;
+}
+
+} // namespace exec
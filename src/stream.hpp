@@ -0,0 +1,100 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exec.hpp>
+#include <history.hpp>
+#include <mutex>
+#include <optional>
+#include <parse.hpp>
+#include <process_pool.hpp>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace exec {
+
+// --stream: the Makefile is read and parsed on a background thread and
+// handed over in chunks. Meanwhile jobs start for rules that are already
+// known to be final:
+//  - the rule is needed by the goal (through rules read so far),
+//  - every prerequisite has its own rule and completed early as well,
+//  - it doesn't depend on pattern rules (instances are only resolved by
+//    Graph::build), a grouped rule or a dyndep file.
+// Anything else waits for the regular Scheduler::run on the full graph.
+// Makefiles that list the goal first and sources last overlap best.
+//
+// Directives or pattern rules that show up after a node completed early
+// can change its meaning; prebuilt() re-validates every early node
+// against the full graph and only those that still hold are skipped.
+class StreamBuild {
+public:
+  static constexpr size_t chunk_lines = 2048;
+
+  StreamBuild(ProcessPool &pool, BuildHistory &history, std::string goal)
+      : m_pool(pool), m_history(history), m_goal(std::move(goal)) {}
+
+  // parses `path` to the end, starting jobs on the way; jobs may still be
+  // running when it returns
+  parse::Result run(const std::string &path);
+
+  // wait for the jobs started by run()
+  void finish();
+
+  // nodes of `graph` that completed early and are still up to date
+  std::vector<NodeId> prebuilt(const Graph &graph) const;
+
+private:
+  enum class State : uint8_t { Idle, Ready, Running, Done };
+
+  struct EarlyNode {
+    std::vector<uint32_t> deps; // order-only ones last
+    std::vector<uint32_t> dependents;
+    uint32_t n_checked = 0; // leading deps compared by mtime
+    Node commands;
+    uint32_t waiting = 0; // prerequisites not done yet
+    State state = State::Idle;
+    bool has_rule = false;
+    bool needed = false;
+    bool ran = false; // done by running its recipe (not skipped)
+  };
+
+  uint32_t intern(const std::string &name);
+  void apply(parse::Result &chunk);
+  void mark_needed(uint32_t id);
+  void try_ready(uint32_t id);
+  void dispatch();
+  bool out_of_date(uint32_t id) const;
+  void complete(uint32_t id, bool ran);
+  void on_result(const ResultMsg &res);
+
+  ProcessPool &m_pool;
+  BuildHistory &m_history;
+  std::string m_goal;
+
+  // parser thread => scheduler
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<parse::Result> m_chunks;
+  bool m_eof = false;
+  std::optional<std::string> m_parse_error; // set with m_eof
+
+  std::unordered_map<std::string, uint32_t> m_ids;
+  std::vector<std::string> m_names;
+  std::vector<EarlyNode> m_nodes;
+  std::vector<std::string> m_patterns;
+  std::unordered_set<std::string> m_phony;
+  std::unordered_set<std::string> m_dyndeps;
+  std::unordered_map<std::string, uint32_t> m_pool_depth;
+  std::unordered_map<std::string, uint32_t> m_pool_running;
+  std::unordered_map<std::string, std::string> m_pool_of;
+  std::unordered_map<std::string, std::deque<uint32_t>> m_pool_waiting;
+
+  std::deque<uint32_t> m_ready;
+  std::vector<uint32_t> m_completed; // completion order
+  uint32_t m_running = 0;
+};
+
+} // namespace exec
@@ -4,12 +4,15 @@
 #include <cctype>
 #include <charconv>
 #include <chrono>
+#include <cstdint>
 #include <cstdlib>
 #include <filesystem>
+#include <format>
 #include <iostream>
 #include <optional>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 [[noreturn]] inline void fatal(const char *msg) {
@@ -17,6 +20,15 @@
   std::exit(EXIT_FAILURE);
 }
 
+// duration for reports: "12.3ms", "4.56s", "7.8m"
+inline std::string fmt_us(uint64_t us) {
+  if (us >= 60'000'000)
+    return std::format("{:.1f}m", static_cast<double>(us) / 60e6);
+  if (us >= 1'000'000)
+    return std::format("{:.2f}s", static_cast<double>(us) / 1e6);
+  return std::format("{:.1f}ms", static_cast<double>(us) / 1e3);
+}
+
 inline void trim(std::string &s) {
   auto not_space = [](unsigned char c) { return c != ' '; };
   s.erase(s.begin(), std::find_if(s.begin(), s.end(), not_space));
@@ -56,8 +68,72 @@ inline bool is_newer(const std::string &file, const std::string &wrt) {
   return ftime > wtime;
 }
 
+// "512M", "16G", "1048576" (bytes) => KiB
+inline std::optional<uint64_t> parse_size_kb(std::string_view s) {
+  uint64_t val;
+  auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), val);
+  if (ec != std::errc{})
+    return std::nullopt;
+
+  std::string_view suffix(ptr, static_cast<size_t>(s.data() + s.size() - ptr));
+  if (suffix.empty())
+    return val / 1024;
+  if (suffix.size() != 1)
+    return std::nullopt;
+
+  switch (std::toupper(static_cast<unsigned char>(suffix[0]))) {
+  case 'K':
+    return val;
+  case 'M':
+    return val << 10;
+  case 'G':
+    return val << 20;
+  case 'T':
+    return val << 30;
+  default:
+    return std::nullopt;
+  }
+}
+
+// "idle", "best-effort[:level]", "realtime[:level]" => (ioprio class, level)
+inline std::optional<std::pair<int, int>> parse_ionice(std::string_view s) {
+  const auto colon = s.find(':');
+  const auto name = s.substr(0, colon);
+
+  int level = 4;
+  if (colon != std::string_view::npos) {
+    auto [ptr, ec] =
+        std::from_chars(s.data() + colon + 1, s.data() + s.size(), level);
+    if (ec != std::errc{} || ptr != s.data() + s.size() || level < 0 ||
+        level > 7)
+      return std::nullopt;
+  }
+
+  if (name == "realtime")
+    return std::pair{1, level};
+  if (name == "best-effort")
+    return std::pair{2, level};
+  if (name == "idle" && colon == std::string_view::npos)
+    return std::pair{3, 0};
+  return std::nullopt;
+}
+
 struct ArgsResult {
   std::optional<int> thread_count;
+  std::optional<uint64_t> mem_budget_kb;
+  std::optional<double> mem_psi_avg10;
+  bool stats = false;
+  bool stats_json = false;
+  std::optional<std::string_view> pin;
+  std::optional<int> nice;
+  std::optional<std::string_view> ionice;
+  bool sched_batch = false;
+  bool progress = false;
+  bool stream = false;
+  bool optimize_graph = false;
+  bool history = false;
+  bool simulate = false;
+  std::optional<std::string_view> query;
   std::vector<std::string_view> forwarded_args;
 
   static inline ArgsResult parse_and_filter(int argc, char *argv[]) {
@@ -91,6 +167,50 @@ struct ArgsResult {
         } else {
           result.thread_count = 0;
         }
+      } else if (arg.starts_with("--mem-budget=")) {
+        // Case: --mem-budget=16G
+        result.mem_budget_kb = parse_size_kb(arg.substr(13));
+        if (!result.mem_budget_kb)
+          fatal("invalid --mem-budget (expected e.g. 512M, 16G)");
+      } else if (arg.starts_with("--mem-psi=")) {
+        // Case: --mem-psi=20 (memory "some" avg10 percentage)
+        double val;
+        auto [ptr, ec] =
+            std::from_chars(arg.data() + 10, arg.data() + arg.size(), val);
+        if (ec != std::errc{} || val <= 0)
+          fatal("invalid --mem-psi (expected a positive percentage)");
+        result.mem_psi_avg10 = val;
+      } else if (arg.starts_with("--pin=")) {
+        // Case: --pin=spread|pack|numa-spread|numa-pack
+        result.pin = arg.substr(6);
+      } else if (arg.starts_with("--nice=")) {
+        int val;
+        auto [ptr, ec] =
+            std::from_chars(arg.data() + 7, arg.data() + arg.size(), val);
+        if (ec != std::errc{})
+          fatal("invalid --nice (expected an integer)");
+        result.nice = val;
+      } else if (arg.starts_with("--ionice=")) {
+        // Case: --ionice=idle, --ionice=best-effort:7
+        result.ionice = arg.substr(9);
+      } else if (arg == "--sched-batch") {
+        result.sched_batch = true;
+      } else if (arg == "--progress") {
+        result.progress = true;
+      } else if (arg == "--stream") {
+        result.stream = true;
+      } else if (arg == "--optimize-graph") {
+        result.optimize_graph = true;
+      } else if (arg == "--history") {
+        result.history = true;
+      } else if (arg == "--simulate") {
+        result.simulate = true;
+      } else if (arg.starts_with("--query=")) {
+        // Case: --query=rdeps|deps|affected
+        result.query = arg.substr(8);
+      } else if (arg == "--stats" || arg == "--stats=json") {
+        result.stats = true;
+        result.stats_json = arg.ends_with("json");
       } else {
         result.forwarded_args.push_back(arg);
       }
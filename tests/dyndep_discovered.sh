@@ -0,0 +1,25 @@
+# A dyndep file names a prerequisite that only it leads to: the scanner's
+# module joins the build with its own prerequisites, and the fingerprint
+# of the goal covers them.
+. "$(dirname "$0")/lib.sh"
+
+printf '%s\n' \
+  '.DYNDEP: scan.dd' \
+  'app: main.o' \
+  '	cp main.o app' \
+  'main.o: scan.dd' \
+  '	cat mod.mod > main.o' \
+  'scan.dd:' \
+  '	echo "main.o: mod.mod" > scan.dd' \
+  'mod.mod: gen.txt' \
+  '	cp gen.txt mod.mod' \
+  'gen.txt:' \
+  '	echo module > gen.txt' > Makefile
+
+"$BUILDIR" -j2 app || fail "first build"
+[ "$(cat app)" = module ] || fail "app built without mod.mod"
+
+sleep 1
+echo changed > gen.txt
+"$BUILDIR" -j2 app || fail "rebuild"
+[ "$(cat app)" = changed ] || fail "gen.txt change not picked up"
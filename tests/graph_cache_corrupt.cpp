@@ -0,0 +1,177 @@
+// Corrupted .graph_cache files: an id out of range in any field must end
+// in a clean "graph cache corrupted" fatal when the cache is loaded, not
+// in out-of-bounds indexing later on.
+
+#include <algorithm>
+#include <cstdlib>
+#include <exec.hpp>
+#include <file_reader.hpp>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <parse.hpp>
+#include <serde_utils.hpp>
+#include <string>
+#include <sys/wait.h>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+using exec::Graph;
+using exec::Node;
+using exec::NodeId;
+using IdLists = std::vector<std::vector<NodeId>>;
+
+// the fields of the cache, in Graph::serialize() order
+struct Cache {
+  std::vector<Node> node_store;
+  IdLists adjgraph;
+  IdLists reverse_adj;
+  std::vector<NodeId> phony;
+  std::vector<std::string> names;
+  std::vector<uint32_t> pool_of;
+  std::vector<std::string> pool_names;
+  std::vector<uint32_t> pool_depths;
+  std::vector<uint32_t> template_of;
+  std::vector<Node> templates;
+  std::vector<std::string> template_targets;
+  std::vector<uint8_t> builtin;
+  std::vector<NodeId> dyndeps;
+  std::vector<NodeId> grouped_ids;
+  std::vector<Node> grouped_outputs;
+  std::vector<NodeId> order_only_ids;
+  IdLists order_only_parents;
+  std::vector<uint32_t> post;
+  std::vector<NodeId> by_post;
+  std::vector<uint32_t> reach_offsets;
+  std::vector<uint32_t> reach_intervals;
+  std::vector<uint32_t> reach_edge_offsets;
+  std::vector<NodeId> reach_edges;
+
+  auto fields() {
+    return std::tie(node_store, adjgraph, reverse_adj, phony, names, pool_of,
+                    pool_names, pool_depths, template_of, templates,
+                    template_targets, builtin, dyndeps, grouped_ids,
+                    grouped_outputs, order_only_ids, order_only_parents, post,
+                    by_post, reach_offsets, reach_intervals,
+                    reach_edge_offsets, reach_edges);
+  }
+
+  static Cache load() {
+    std::ifstream in(Graph::serialize_file, std::ios::binary);
+    std::vector<char> raw{std::istreambuf_iterator<char>(in), {}};
+    const std::vector<std::byte> bytes(
+        reinterpret_cast<const std::byte *>(raw.data()),
+        reinterpret_cast<const std::byte *>(raw.data() + raw.size()));
+
+    serde::Reader reader(bytes);
+    Cache cache;
+    reader.read<uint32_t>(); // version
+    std::apply(
+        [&reader](auto &...field) {
+          ((field = reader.read<std::remove_cvref_t<decltype(field)>>()), ...);
+        },
+        cache.fields());
+    if (!reader.at_end()) {
+      fatal("graph_cache_corrupt: unexpected cache layout");
+    }
+    return cache;
+  }
+
+  void save() {
+    const auto bytes = std::apply(
+        [](const auto &...field) {
+          return serde::serialize_all(Graph::GRAPH_SERDE_VERSION, field...);
+        },
+        fields());
+    std::ofstream out(Graph::serialize_file, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(bytes.data()),
+              static_cast<std::streamsize>(bytes.size()));
+  }
+};
+
+// exit status of Graph::deserialize() in a child process (it may fatal)
+int load_status() {
+  const pid_t pid = fork();
+  if (pid == 0) {
+    Graph::deserialize();
+    std::exit(EXIT_SUCCESS);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+} // namespace
+
+int main() {
+  char dir[] = "/tmp/buildir-cache-XXXXXX";
+  if (!mkdtemp(dir) || chdir(dir) != 0) {
+    fatal("graph_cache_corrupt: no scratch directory");
+  }
+
+  std::ofstream("main.c") << "int main() {}\n";
+  std::ofstream("Makefile") << ".PHONY: all\n"
+                               ".POOL: link 1\n"
+                               ".USE_POOL: link app\n"
+                               "all: app\n"
+                               "app: main.o | out\n"
+                               "\tcp main.o app\n"
+                               "%.o: %.c\n"
+                               "\tcp $< $@\n"
+                               "out:\n"
+                               "\tmkdir -p out\n";
+  auto graph = Graph::build(
+      parse::MakefileParser().parse(FileReader("Makefile").read_lines()));
+  graph.build_reach_index();
+  graph.serialize();
+
+  const Cache valid = Cache::load();
+  const auto n = static_cast<NodeId>(valid.names.size());
+  auto first_of = [](const std::vector<uint32_t> &ids, uint32_t none) {
+    return static_cast<size_t>(
+        std::find_if(ids.begin(), ids.end(),
+                     [none](uint32_t id) { return id != none; }) -
+        ids.begin());
+  };
+
+  const std::pair<const char *, std::function<void(Cache &)>> cases[] = {
+      {"adjgraph", [n](Cache &c) { c.adjgraph[0].push_back(n); }},
+      {"reverse_adj", [n](Cache &c) { c.reverse_adj[0].push_back(n); }},
+      {"phony", [n](Cache &c) { c.phony.push_back(n); }},
+      {"order_only_parents",
+       [n](Cache &c) { c.order_only_parents.at(0).push_back(n); }},
+      {"template_of",
+       [&](Cache &c) {
+         c.template_of.at(first_of(c.template_of, Graph::no_template)) =
+             static_cast<uint32_t>(c.templates.size());
+       }},
+      {"pool_of",
+       [&](Cache &c) {
+         c.pool_of.at(first_of(c.pool_of, Graph::no_pool)) =
+             static_cast<uint32_t>(c.pool_names.size());
+       }},
+  };
+
+  int failed = 0;
+  if (load_status() != EXIT_SUCCESS) {
+    std::cerr << "FAIL: valid cache rejected\n";
+    failed++;
+  }
+  for (const auto &[field, corrupt] : cases) {
+    Cache cache = valid;
+    corrupt(cache);
+    cache.save();
+    if (load_status() != EXIT_FAILURE) {
+      std::cerr << "FAIL: out-of-range id in " << field << " accepted\n";
+      failed++;
+    }
+  }
+
+  std::filesystem::remove_all(dir);
+  return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,31 @@
+# Failed jobs, and the jobs of a batch that never ran because an earlier
+# one failed or killed its worker, must not end up in .build_history.
+. "$(dirname "$0")/lib.sh"
+
+makefile() {
+  printf 'all:'
+  for i in $(seq 0 39); do printf ' o%s' "$i"; done
+  printf '\n'
+  for i in $(seq 0 39); do printf "o%s:\n\t$1\n" "$i" "$i"; done
+}
+
+# two successful runs: the second one batches the (now measured) jobs
+makefile 'cp flag o%s' > Makefile
+touch flag
+"$BUILDIR" -j1 all > /dev/null || fail "first build"
+rm -f o*
+"$BUILDIR" -j1 all > /dev/null || fail "second build"
+size=$(wc -c < .build_history)
+
+rm -f o* flag
+if "$BUILDIR" -j1 all > /dev/null 2>&1; then
+  fail "build without flag succeeded"
+fi
+[ "$(wc -c < .build_history)" = "$size" ] || fail "failed jobs were recorded"
+
+makefile 'kill -9 $PPID # o%s' > Makefile
+rm -f o*
+if "$BUILDIR" -j1 all > /dev/null 2>&1; then
+  fail "build with a killed worker succeeded"
+fi
+[ "$(wc -c < .build_history)" = "$size" ] || fail "unrun jobs were recorded"
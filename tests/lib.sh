@@ -0,0 +1,13 @@
+# Sourced by every test: $1 is the buildir binary. Runs the test in a
+# fresh scratch directory that is removed on exit.
+set -eu
+
+BUILDIR=$1
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+cd "$scratch"
+
+fail() {
+  echo "FAIL: $*" >&2
+  exit 1
+}